@@ -0,0 +1,594 @@
+/**
+ * \file
+ *         Host microbenchmark of the input callbacks of one firmware
+ *
+ *         bench [-n runs] trace...
+ *
+ *         Every trace is replayed runs times, each run in a fresh process so
+ *         the firmware starts from its boot state. The first run checks the
+ *         frames sent, the process events and the printed lines against the
+ *         trace; every run times each delivered frame. A trace is a text
+ *         file, one directive per line ('#' starts a comment):
+ *
+ *         node A.B                  address of the node
+ *         clock TICKS               virtual clock
+ *         rssi N                    RSSI of the next frames received
+ *         set VAR VALUE             set a static variable of the firmware
+ *         call FUNCTION [ARG]       call a function of the firmware
+ *         rx CALLBACK SRC KEYWORD [FIELD...]
+ *                                   deliver a frame to an input callback
+ *         rxraw CALLBACK SRC TEXT   deliver TEXT with no NUL (UNCHANGED)
+ *         tx DEST KEYWORD [FIELD...]
+ *         txraw DEST TEXT           next frame sent, DEST is A.B or broadcast
+ *         event KIND PROCESS        next process event, KIND is poll, start or exit
+ *         out TEXT...               a line printed since the last rx or call starts with TEXT
+ *         expect VAR VALUE          value of a static variable of the firmware
+ *
+ *         FIELD is TYPE:VALUE with TYPE one of u8, u16, u32, i8, i16, i32 or
+ *         addr (LINKADDR_SIZE bytes, A.B sets the first two), and is packed
+ *         after the NUL of the keyword; in tx lines a
+ *         VALUE of * matches anything. Every frame sent and every event
+ *         raised by an rx or a call must be matched by the tx and event lines
+ *         that follow it.
+ */
+
+#define _GNU_SOURCE
+#include "bench.h"
+#include "cc2420.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#undef printf // the bench itself prints to stdout
+
+#define DEFAULT_RUNS 500
+#define MAX_TOKENS 16
+
+enum step_kind { BLANK, NODE, CLOCK, RSSI, SET, CALL, RX, TX, EVENT, OUT, EXPECT };
+
+struct step {
+    enum step_kind kind;
+    int line; // line in the trace
+    linkaddr_t addr; // node, rx source, tx destination
+    bool broadcast;
+    long value; // clock, rssi, set, call, expect
+    const struct bench_callback *callback;
+    const struct bench_call *call;
+    const struct bench_var *var;
+    uint16_t len; // rx and tx frame
+    uint8_t data[BENCH_MAX_FRAME];
+    uint8_t mask[BENCH_MAX_FRAME]; // bytes of a tx frame that must match
+    char text[BENCH_MAX_LINE]; // event, out, keyword of an rx
+    int rx; // index of an rx among the rx steps of the trace
+};
+
+struct trace {
+    const char *path;
+    struct step *steps;
+    int count;
+    int rx_count;
+};
+
+static const char *path; // trace being parsed or played, for the messages
+static long timer_overhead = 0; // ns of a clock_gettime() pair, removed from the timings
+
+/*---------------------------------------------------------------------------*/
+static bool parse_addr(const char *s, linkaddr_t *addr) {
+    unsigned a, b;
+    char end;
+    if (sscanf(s, "%u.%u%c", &a, &b, &end) != 2 || a > 255 || b > 255) {
+        return false;
+    }
+    // the first two bytes, as the firmware prints addresses
+    memset(addr, 0, sizeof(*addr));
+    addr->u8[0] = a;
+    addr->u8[1] = b;
+    return true;
+}
+
+static bool parse_long(const char *s, long *value) {
+    char *end;
+    errno = 0;
+    *value = strtol(s, &end, 0);
+    return errno == 0 && end != s && *end == '\0';
+}
+
+static bool parse_field(const char *field, struct step *step, bool wildcard) {
+    // append TYPE:VALUE to the frame of step
+    static const struct { const char *type; uint8_t size; } types[] = {
+        { "u8", 1 }, { "i8", 1 }, { "u16", 2 }, { "i16", 2 }, { "u32", 4 }, { "i32", 4 },
+        { "addr", sizeof(linkaddr_t) },
+    };
+    const char *value = strchr(field, ':');
+    if (value == NULL) {
+        return false;
+    }
+    value++;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        size_t type_len = strlen(types[i].type);
+        uint8_t size = types[i].size;
+        if (strncmp(field, types[i].type, type_len) != 0 || field[type_len] != ':') {
+            continue;
+        }
+        if (step->len + size > BENCH_MAX_FRAME) {
+            return false;
+        }
+        if (wildcard && strcmp(value, "*") == 0) {
+            memset(step->mask + step->len, 0, size);
+        } else if (strcmp(types[i].type, "addr") == 0) {
+            linkaddr_t addr;
+            if (!parse_addr(value, &addr)) {
+                return false;
+            }
+            memcpy(step->data + step->len, &addr, size);
+            memset(step->mask + step->len, 0xff, size);
+        } else {
+            long v;
+            if (!parse_long(value, &v)) {
+                return false;
+            }
+            // little-endian as the motes and the host
+            memcpy(step->data + step->len, &v, size);
+            memset(step->mask + step->len, 0xff, size);
+        }
+        step->len += size;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_frame(char **tokens, int count, struct step *step, bool raw, bool wildcard) {
+    // tokens are the keyword (or the raw text) and the fields
+    size_t keyword_len = strlen(tokens[0]) + (raw ? 0 : 1);
+    if (keyword_len > BENCH_MAX_FRAME || (raw && count != 1)) {
+        return false;
+    }
+    memcpy(step->data, tokens[0], keyword_len);
+    memset(step->mask, 0xff, keyword_len);
+    step->len = keyword_len;
+    snprintf(step->text, sizeof(step->text), "%s", tokens[0]);
+    for (int i = 1; i < count; i++) {
+        if (!parse_field(tokens[i], step, wildcard)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const struct bench_var *find_var(const char *name) {
+    for (const struct bench_var *var = bench_vars; var->name != NULL; var++) {
+        if (strcmp(var->name, name) == 0) {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+static bool parse_step(char *line, struct step *step) {
+    char *tokens[MAX_TOKENS];
+    int count = 0;
+
+    line[strcspn(line, "#\n")] = '\0';
+    for (char *token = strtok(line, " \t\r"); token != NULL; token = strtok(NULL, " \t\r")) {
+        if (count == MAX_TOKENS) {
+            return false;
+        }
+        tokens[count++] = token;
+    }
+    if (count == 0) {
+        step->kind = BLANK;
+        return true;
+    }
+    const char *directive = tokens[0];
+    if (strcmp(directive, "node") == 0 && count == 2) {
+        step->kind = NODE;
+        return parse_addr(tokens[1], &step->addr);
+    }
+    if ((strcmp(directive, "clock") == 0 || strcmp(directive, "rssi") == 0) && count == 2) {
+        step->kind = directive[0] == 'c' ? CLOCK : RSSI;
+        return parse_long(tokens[1], &step->value);
+    }
+    if ((strcmp(directive, "set") == 0 || strcmp(directive, "expect") == 0) && count == 3) {
+        step->kind = directive[0] == 's' ? SET : EXPECT;
+        step->var = find_var(tokens[1]);
+        if (step->var == NULL) {
+            return false;
+        }
+        if (step->var->is_addr) {
+            return parse_addr(tokens[2], &step->addr);
+        }
+        return parse_long(tokens[2], &step->value);
+    }
+    if (strcmp(directive, "call") == 0 && (count == 2 || count == 3)) {
+        step->kind = CALL;
+        for (step->call = bench_calls; step->call->name != NULL; step->call++) {
+            if (strcmp(step->call->name, tokens[1]) == 0) {
+                return count == 2 || parse_long(tokens[2], &step->value);
+            }
+        }
+        return false;
+    }
+    if ((strcmp(directive, "rx") == 0 || strcmp(directive, "rxraw") == 0) && count >= 4) {
+        step->kind = RX;
+        for (step->callback = bench_callbacks; step->callback->name != NULL; step->callback++) {
+            if (strcmp(step->callback->name, tokens[1]) == 0) {
+                return parse_addr(tokens[2], &step->addr)
+                    && parse_frame(tokens + 3, count - 3, step, directive[2] == 'r', false);
+            }
+        }
+        return false;
+    }
+    if ((strcmp(directive, "tx") == 0 || strcmp(directive, "txraw") == 0) && count >= 3) {
+        step->kind = TX;
+        step->broadcast = strcmp(tokens[1], "broadcast") == 0;
+        return (step->broadcast || parse_addr(tokens[1], &step->addr))
+            && parse_frame(tokens + 2, count - 2, step, directive[2] == 'r', true);
+    }
+    if (strcmp(directive, "event") == 0 && count == 3) {
+        step->kind = EVENT;
+        snprintf(step->text, sizeof(step->text), "%s %s", tokens[1], tokens[2]);
+        return true;
+    }
+    if (strcmp(directive, "out") == 0 && count >= 2) {
+        // the tokens were split in place, join them back
+        step->kind = OUT;
+        step->text[0] = '\0';
+        for (int i = 1; i < count; i++) {
+            snprintf(step->text + strlen(step->text), sizeof(step->text) - strlen(step->text), "%s%s", i > 1 ? " " : "", tokens[i]);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool load_trace(const char *trace_path, struct trace *trace) {
+    FILE *f = fopen(trace_path, "r");
+    char line[256];
+    int line_number = 0;
+    int capacity = 0;
+
+    path = trace_path;
+    memset(trace, 0, sizeof(*trace));
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", trace_path, strerror(errno));
+        return false;
+    }
+    trace->path = trace_path;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        struct step step;
+        line_number++;
+        memset(&step, 0, sizeof(step));
+        step.line = line_number;
+        if (!parse_step(line, &step)) {
+            fprintf(stderr, "%s:%d: cannot parse this line\n", trace_path, line_number);
+            fclose(f);
+            return false;
+        }
+        if (step.kind == BLANK) {
+            continue;
+        }
+        if (step.kind == RX) {
+            step.rx = trace->rx_count++;
+        }
+        if (trace->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            trace->steps = realloc(trace->steps, capacity * sizeof(struct step));
+        }
+        trace->steps[trace->count++] = step;
+    }
+    fclose(f);
+    if (trace->rx_count == 0) {
+        fprintf(stderr, "%s: no frame delivered\n", trace_path);
+        return false;
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void format_frame(char *out, size_t size, const uint8_t *data, uint16_t len) {
+    // keyword then payload in hex
+    uint16_t keyword_len = strnlen((const char *) data, len);
+    int n = snprintf(out, size, "'%.*s'", keyword_len, (const char *) data);
+    for (uint16_t i = keyword_len + 1; i < len && n < (int) size; i++) {
+        n += snprintf(out + n, size - n, " %02x", data[i]);
+    }
+}
+
+static bool fail(const struct step *step, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static bool fail(const struct step *step, const char *format, ...) {
+    va_list ap;
+    fprintf(stderr, "%s:%d: ", path, step->line);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    return false;
+}
+
+static long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+static bool check_consumed(const struct step *step, int tx, int events) {
+    // every frame and event of the previous rx or call was matched
+    char frame[3 * BENCH_MAX_FRAME];
+    if (bench_overflow) {
+        return fail(step, "more than %d frames, events or lines before this line", BENCH_MAX_LOG);
+    }
+    if (tx < bench_tx_count) {
+        format_frame(frame, sizeof(frame), bench_tx_log[tx].data, bench_tx_log[tx].len);
+        return fail(step, "unexpected frame %s to %d.%d before this line", frame,
+                    bench_tx_log[tx].dest.u8[0], bench_tx_log[tx].dest.u8[1]);
+    }
+    if (events < bench_event_count) {
+        return fail(step, "unexpected event '%s' before this line", bench_event_log[events]);
+    }
+    return true;
+}
+
+static void warm_up(void) {
+    // a forked run gets its static data and its stack copy-on-write, take
+    // the page faults here instead of in the first callback writing to each page
+    extern char __data_start[], _end[];
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char stack[64 * 1024];
+    for (volatile char *p = __data_start; p < _end; p += page) {
+        *p = *p;
+    }
+    for (size_t i = 0; i < sizeof(stack); i += page) {
+        stack[i] = 0;
+    }
+    // and of the first snprintf(), used by the mock process events and printf()
+    snprintf((char *) stack, BENCH_MAX_LINE, "%s %d.%d %lu", "warm up", 1, 0, 1000ul);
+}
+
+static bool play(const struct trace *trace, long *timings, bool check) {
+    // replay the trace once, timing[i] is the time spent in the i-th rx
+    int tx = 0, events = 0, out = 0; // next entries of the logs to match
+    char frame[3 * BENCH_MAX_FRAME];
+
+    warm_up();
+    bench_boot();
+    bench_reset_logs();
+    for (int i = 0; i < trace->count; i++) {
+        const struct step *step = &trace->steps[i];
+        switch (step->kind) {
+        case BLANK:
+            break;
+        case NODE:
+            linkaddr_node_addr = step->addr;
+            break;
+        case CLOCK:
+            bench_clock = step->value;
+            break;
+        case RSSI:
+            cc2420_last_rssi = step->value;
+            break;
+        case SET:
+            if (step->var->is_addr) {
+                memcpy(step->var->ptr, &step->addr, sizeof(linkaddr_t));
+            } else {
+                memcpy(step->var->ptr, &step->value, step->var->size); // little-endian
+            }
+            break;
+        case CALL:
+        case RX:
+            if (check && !check_consumed(step, tx, events)) {
+                return false;
+            }
+            bench_reset_logs();
+            tx = events = out = 0;
+            if (step->kind == CALL) {
+                step->call->fn(step->value);
+            } else {
+                // the radio driver hands over a buffer of its own
+                uint8_t data[BENCH_MAX_FRAME];
+                memcpy(data, step->data, step->len);
+                long start = now_ns();
+                step->callback->input(data, step->len, &step->addr, &linkaddr_node_addr);
+                long elapsed = now_ns() - start - timer_overhead;
+                timings[step->rx] = elapsed > 0 ? elapsed : 0;
+            }
+            break;
+        case TX:
+            if (!check) {
+                break;
+            }
+            if (tx == bench_tx_count) {
+                return fail(step, "frame '%s' was not sent", step->text);
+            }
+            const struct bench_tx *sent = &bench_tx_log[tx++];
+            bool match = sent->len == step->len && sent->broadcast == step->broadcast
+                && (step->broadcast || linkaddr_cmp(&sent->dest, &step->addr));
+            for (int k = 0; match && k < step->len; k++) {
+                match = ((sent->data[k] ^ step->data[k]) & step->mask[k]) == 0;
+            }
+            if (!match) {
+                format_frame(frame, sizeof(frame), sent->data, sent->len);
+                return fail(step, "sent %s to %s%d.%d instead", frame, sent->broadcast ? "broadcast " : "",
+                            sent->dest.u8[0], sent->dest.u8[1]);
+            }
+            break;
+        case EVENT:
+            if (check && (events == bench_event_count || strcmp(bench_event_log[events++], step->text) != 0)) {
+                return fail(step, "event '%s' not raised", step->text);
+            }
+            break;
+        case OUT:
+            if (!check) {
+                break;
+            }
+            while (out < bench_out_count && strncmp(bench_out_log[out], step->text, strlen(step->text)) != 0) {
+                out++;
+            }
+            if (out == bench_out_count) {
+                return fail(step, "no line starting with '%s' printed", step->text);
+            }
+            out++;
+            break;
+        case EXPECT:
+            if (check) {
+                long value = 0;
+                if (step->var->is_addr) {
+                    const linkaddr_t *addr = step->var->ptr;
+                    if (!linkaddr_cmp(addr, &step->addr)) {
+                        return fail(step, "%s is %d.%d, not %d.%d", step->var->name, addr->u8[0], addr->u8[1],
+                                    step->addr.u8[0], step->addr.u8[1]);
+                    }
+                    break;
+                } else if (step->var->is_signed) {
+                    int64_t v = 0;
+                    memcpy(&v, step->var->ptr, step->var->size);
+                    value = (int64_t) (v << (64 - 8 * step->var->size)) >> (64 - 8 * step->var->size); // sign extend
+                } else {
+                    memcpy(&value, step->var->ptr, step->var->size);
+                }
+                if (value != step->value) {
+                    return fail(step, "%s is %ld, not %ld", step->var->name, value, step->value);
+                }
+            }
+            break;
+        }
+    }
+    return !check || check_consumed(&trace->steps[trace->count - 1], tx, events);
+}
+
+/*---------------------------------------------------------------------------*/
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+static void report_group(const char *name, long *samples, int n) {
+    qsort(samples, n, sizeof(long), compare_long);
+    printf("  %-28s n=%-7d p50=%6ldns p99=%6ldns max=%7ldns\n", name, n,
+           samples[n / 2], samples[n - 1 - n / 100], samples[n - 1]);
+}
+
+static void report(const struct trace *trace, const long *timings, int runs) {
+    // per callback and keyword, in the order of the trace, then every frame
+    long *samples = malloc((size_t) runs * trace->rx_count * sizeof(long));
+    long total = 0;
+    bool *done = calloc(trace->count, sizeof(bool));
+
+    printf("%s %s: ok, %d frames x %d runs\n", bench_firmware, trace->path, trace->rx_count, runs);
+    for (int i = 0; i < trace->count; i++) {
+        const struct step *first = &trace->steps[i];
+        char name[BENCH_MAX_LINE];
+        int n = 0;
+        if (first->kind != RX || done[i]) {
+            continue;
+        }
+        for (int j = i; j < trace->count; j++) {
+            const struct step *step = &trace->steps[j];
+            if (step->kind != RX || step->callback != first->callback || strcmp(step->text, first->text) != 0) {
+                continue;
+            }
+            done[j] = true;
+            for (int run = 0; run < runs; run++) {
+                samples[n++] = timings[run * trace->rx_count + step->rx];
+            }
+        }
+        snprintf(name, sizeof(name), "%s %s", first->callback->name, first->text);
+        report_group(name, samples, n);
+    }
+    for (int k = 0; k < runs * trace->rx_count; k++) {
+        samples[k] = timings[k];
+        total += timings[k];
+    }
+    if (trace->rx_count > 0) {
+        report_group("all frames", samples, runs * trace->rx_count);
+        printf("  throughput %.0f frames/s\n", total > 0 ? 1e9 * runs * trace->rx_count / total : 0.0);
+    }
+    free(done);
+    free(samples);
+}
+
+static bool run(const struct trace *trace, int runs) {
+    // one process per run, the firmware keeps its state in static variables
+    size_t size = (size_t) runs * (trace->rx_count ? trace->rx_count : 1) * sizeof(long);
+    long *timings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    bool ok = true;
+
+    path = trace->path;
+    if (timings == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    for (int k = 0; k < runs && ok; k++) {
+        int status;
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            ok = false;
+            break;
+        }
+        if (pid == 0) {
+            _exit(play(trace, timings + (size_t) k * trace->rx_count, k == 0) ? 0 : 1);
+        }
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (WIFSIGNALED(status)) {
+                fprintf(stderr, "%s: killed by signal %d\n", trace->path, WTERMSIG(status));
+            }
+            ok = false;
+        }
+    }
+    if (ok) {
+        report(trace, timings, runs);
+    } else {
+        printf("%s %s: FAILED\n", bench_firmware, trace->path);
+    }
+    munmap(timings, size);
+    return ok;
+}
+
+static void calibrate(void) {
+    // smallest cost of the two clock_gettime() calls around a callback
+    timer_overhead = -1;
+    for (int i = 0; i < 10000; i++) {
+        long start = now_ns();
+        long elapsed = now_ns() - start;
+        if (timer_overhead < 0 || elapsed < timer_overhead) {
+            timer_overhead = elapsed;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            runs = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n runs] trace...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "usage: %s [-n runs] trace...\n", argv[0]);
+        return 2;
+    }
+    calibrate();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    for (int i = optind; i < argc; i++) {
+        struct trace trace;
+        if (!load_trace(argv[i], &trace) || !run(&trace, runs)) {
+            failed++;
+        }
+        free(trace.steps);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "contiki.h"
+#include "net/nullnet/nullnet.h"
+
+/*
+ * Glue between the trace player (bench.c), the mock kernel (mock.c) and one
+ * firmware, compiled with it in a single translation unit (sensor_glue.c,
+ * border_glue.c) so that traces can set and check its static state.
+ */
+
+/* input callbacks of the firmware, delivered to by the "rx" lines */
+struct bench_callback {
+    const char *name;
+    nullnet_input_callback input;
+};
+
+/* functions of the firmware a trace can "call", with an optional argument */
+struct bench_call {
+    const char *name;
+    void (*fn)(long arg);
+};
+
+/* static variables of the firmware a trace can "set" and "expect" */
+struct bench_var {
+    const char *name;
+    void *ptr;
+    uint8_t size;
+    bool is_signed;
+    bool is_addr; // linkaddr_t, written A.B
+};
+
+#define BENCH_VAR(v) { #v, &(v), sizeof(v), (__typeof__(v)) -1 < 0, false }
+#define BENCH_ADDR(v) { #v, &(v), sizeof(linkaddr_t), false, true }
+
+/* provided by the glue, the tables end with a NULL name */
+extern const char *bench_firmware;
+extern const struct bench_callback bench_callbacks[];
+extern const struct bench_call bench_calls[];
+extern const struct bench_var bench_vars[];
+void bench_boot(void); // state of the firmware once its processes have set up nullnet
+
+/* provided by mock.c, what the firmware did since the last check */
+#define BENCH_MAX_LOG 64
+#define BENCH_MAX_FRAME 128
+#define BENCH_MAX_LINE 128
+
+struct bench_tx {
+    bool broadcast;
+    linkaddr_t dest;
+    uint16_t len;
+    uint8_t data[BENCH_MAX_FRAME];
+};
+
+extern clock_time_t bench_clock;
+extern struct bench_tx bench_tx_log[BENCH_MAX_LOG];
+extern int bench_tx_count;
+extern char bench_event_log[BENCH_MAX_LOG][BENCH_MAX_LINE]; // "poll <process>", "start <process>", "exit <process>"
+extern int bench_event_count;
+extern char bench_out_log[BENCH_MAX_LOG][BENCH_MAX_LINE]; // lines printed by the firmware
+extern int bench_out_count;
+extern bool bench_overflow; // one of the logs was full, the trace fails
+
+void bench_reset_logs(void);
+
+#endif /* BENCH_H_ */
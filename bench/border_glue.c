@@ -0,0 +1,49 @@
+/* border.c under the bench, see bench.h */
+#include "border.c"
+#include "bench.h"
+
+const char *bench_firmware = "border";
+
+const struct bench_callback bench_callbacks[] = {
+    { "border", input_callback },
+    { NULL, NULL }
+};
+
+static void call_synchronization(long arg) { (void) arg; synchronization(); }
+static void call_request_clocks(long arg) { (void) arg; request_clocks(); }
+static void call_timeslotting(long arg) { (void) arg; timeslotting(); }
+static void call_send_timeslots(long arg) { (void) arg; sendTimeslots(); }
+static void call_send_sensor_data(long arg) { (void) arg; send_sensor_data(); }
+
+const struct bench_call bench_calls[] = {
+    { "synchronization", call_synchronization },
+    { "request_clocks", call_request_clocks },
+    { "timeslotting", call_timeslotting },
+    { "sendTimeslots", call_send_timeslots },
+    { "send_sensor_data", call_send_sensor_data },
+    { NULL, NULL }
+};
+
+const struct bench_var bench_vars[] = {
+    BENCH_VAR(state),
+    BENCH_VAR(stop),
+    BENCH_VAR(number_of_sensors),
+    BENCH_VAR(number_of_coordinators),
+    BENCH_VAR(number_of_pending),
+    BENCH_VAR(number_of_messages),
+    BENCH_VAR(reported),
+    BENCH_VAR(unchanged),
+    BENCH_VAR(window_number),
+    BENCH_VAR(waiting_for_sync),
+    BENCH_VAR(clock_round),
+    BENCH_VAR(clock_received),
+    BENCH_VAR(offset),
+    { NULL, NULL, 0, false, false }
+};
+
+void bench_boot(void) {
+    // as the init process once it has broadcast "border"
+    state = 0;
+    nullnet_buf = (uint8_t *) &tx_buffer;
+    nullnet_len = MESSAGE_SIZE;
+}
@@ -0,0 +1,4 @@
+#ifndef CC2420_H_
+#define CC2420_H_
+extern signed char cc2420_last_rssi; // set by the "rssi" lines of a trace
+#endif /* CC2420_H_ */
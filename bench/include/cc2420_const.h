@@ -0,0 +1 @@
+/* nothing of cc2420_const.h is used by the firmware */
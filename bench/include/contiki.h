@@ -0,0 +1,83 @@
+#ifndef CONTIKI_H_
+#define CONTIKI_H_
+
+/*
+ * Host build of the Contiki-NG API used by sensor.c and border.c, see
+ * mock.c. Processes are declared but never scheduled: the bench calls the
+ * input callbacks directly and records what they ask of the kernel.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* firmware output goes to the bench, which checks the "out" lines of a trace */
+int bench_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+#define printf bench_printf
+
+typedef unsigned long clock_time_t;
+#define CLOCK_SECOND 128
+
+/* 2 as on the sky motes; the *-addr8 benches replay the same traces with
+ * the 8 bytes of the Contiki-NG default, frames grow with it */
+#ifndef LINKADDR_SIZE
+#define LINKADDR_SIZE 2
+#endif
+typedef union {
+    uint8_t u8[LINKADDR_SIZE];
+#if LINKADDR_SIZE == 2
+    uint16_t u16;
+#endif
+} linkaddr_t;
+extern const linkaddr_t linkaddr_null;
+extern linkaddr_t linkaddr_node_addr;
+int linkaddr_cmp(const linkaddr_t *a, const linkaddr_t *b);
+
+clock_time_t clock_time(void);
+unsigned long clock_seconds(void);
+
+struct etimer { clock_time_t start, interval; };
+void etimer_set(struct etimer *t, clock_time_t interval);
+void etimer_reset(struct etimer *t);
+int etimer_expired(struct etimer *t);
+
+typedef unsigned char process_event_t;
+typedef void *process_data_t;
+
+/* protothreads on a switch statement, as lc-switch.h */
+typedef unsigned short lc_t;
+struct pt { lc_t lc; };
+#define PT_YIELDED 1
+#define PT_ENDED 3
+#define LC_RESUME(s) switch(s) { case 0:
+#define LC_SET(s) s = __LINE__; case __LINE__:
+#define LC_END(s) }
+
+/* the name of a process is its C identifier, the bench reports events with it */
+struct process {
+    const char *name;
+    char (*thread)(struct pt *, process_event_t, process_data_t);
+    struct pt pt;
+};
+#define PROCESS_THREAD(name, ev, data) \
+    static char process_thread_##name(struct pt *process_pt, process_event_t ev, process_data_t data)
+#define PROCESS(name, strname) \
+    PROCESS_THREAD(name, ev, data); \
+    struct process name = { #name, process_thread_##name, { 0 } }
+#define AUTOSTART_PROCESSES(...) \
+    static struct process * const autostart_processes[] __attribute__((unused)) = {__VA_ARGS__, NULL}
+#define PROCESS_BEGIN() { char PT_YIELD_FLAG = 1; (void) PT_YIELD_FLAG; LC_RESUME(process_pt->lc);
+#define PROCESS_END() LC_END(process_pt->lc); PT_YIELD_FLAG = 0; process_pt->lc = 0; return PT_ENDED; }
+#define PROCESS_WAIT_EVENT_UNTIL(c) \
+    do { PT_YIELD_FLAG = 0; LC_SET(process_pt->lc); if((PT_YIELD_FLAG == 0) || !(c)) { return PT_YIELDED; } } while(0)
+#define PROCESS_YIELD() PROCESS_WAIT_EVENT_UNTIL(1)
+#define PROCESS_EVENT_POLL 0x82
+#define PROCESS_EVENT_EXIT 0x83
+#define PROCESS_EVENT_TIMER 0x88
+
+void process_poll(struct process *p);
+void process_start(struct process *p, process_data_t data);
+void process_exit(struct process *p);
+
+#endif /* CONTIKI_H_ */
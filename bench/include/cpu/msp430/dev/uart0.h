@@ -0,0 +1,4 @@
+#ifndef UART0_H_
+#define UART0_H_
+void uart0_set_input(int (*input)(unsigned char c));
+#endif /* UART0_H_ */
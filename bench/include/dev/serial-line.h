@@ -0,0 +1,5 @@
+#ifndef SERIAL_LINE_H_
+#define SERIAL_LINE_H_
+#include "contiki.h"
+int serial_line_input_byte(unsigned char c);
+#endif /* SERIAL_LINE_H_ */
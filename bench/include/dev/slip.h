@@ -0,0 +1 @@
+/* nothing of slip.h is used by the firmware */
@@ -0,0 +1,4 @@
+#ifndef RANDOM_H_
+#define RANDOM_H_
+unsigned short random_rand(void); // deterministic, every run of a trace gets the same numbers
+#endif /* RANDOM_H_ */
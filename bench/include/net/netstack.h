@@ -0,0 +1,6 @@
+#ifndef NETSTACK_H_
+#define NETSTACK_H_
+#include "contiki.h"
+struct network_driver { int (*output)(const linkaddr_t *dest); };
+extern const struct network_driver NETSTACK_NETWORK;
+#endif /* NETSTACK_H_ */
@@ -0,0 +1,7 @@
+#ifndef LOG_H_
+#define LOG_H_
+/* logs are compiled out, the bench measures the protocol and not the uart */
+#define LOG_INFO(...) do { } while(0)
+#define LOG_DBG(...) do { } while(0)
+#define LOG_WARN(...) do { } while(0)
+#endif /* LOG_H_ */
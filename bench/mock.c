@@ -0,0 +1,137 @@
+#include "bench.h"
+#include "net/netstack.h"
+#include "cc2420.h"
+#include "dev/serial-line.h"
+#include "cpu/msp430/dev/uart0.h"
+#include "lib/random.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+/*
+ * Mock kernel: a virtual clock set by the trace, and logs of the frames sent,
+ * the process events raised and the lines printed by the firmware, which the
+ * trace player compares with the trace.
+ */
+
+clock_time_t bench_clock = 0;
+struct bench_tx bench_tx_log[BENCH_MAX_LOG];
+int bench_tx_count = 0;
+char bench_event_log[BENCH_MAX_LOG][BENCH_MAX_LINE];
+int bench_event_count = 0;
+char bench_out_log[BENCH_MAX_LOG][BENCH_MAX_LINE];
+int bench_out_count = 0;
+bool bench_overflow = false;
+
+const linkaddr_t linkaddr_null = { { 0, 0 } };
+linkaddr_t linkaddr_node_addr = { { 0, 0 } };
+signed char cc2420_last_rssi = 0;
+uint8_t *nullnet_buf = NULL;
+uint16_t nullnet_len = 0;
+
+void bench_reset_logs(void) {
+    bench_tx_count = 0;
+    bench_event_count = 0;
+    bench_out_count = 0;
+    bench_overflow = false;
+}
+
+static void event(const char *kind, struct process *p) {
+    if (bench_event_count == BENCH_MAX_LOG) {
+        bench_overflow = true;
+        return;
+    }
+    snprintf(bench_event_log[bench_event_count++], BENCH_MAX_LINE, "%s %s", kind, p->name);
+}
+
+int bench_printf(const char *format, ...) {
+    va_list ap;
+    int n;
+    if (bench_out_count == BENCH_MAX_LOG) {
+        bench_overflow = true;
+        return 0;
+    }
+    va_start(ap, format);
+    n = vsnprintf(bench_out_log[bench_out_count], BENCH_MAX_LINE, format, ap);
+    va_end(ap);
+    // one entry per line, the firmware always ends its lines with "\n"
+    bench_out_log[bench_out_count][strcspn(bench_out_log[bench_out_count], "\n")] = '\0';
+    bench_out_count++;
+    return n;
+}
+
+int linkaddr_cmp(const linkaddr_t *a, const linkaddr_t *b) {
+    return memcmp(a, b, sizeof(linkaddr_t)) == 0;
+}
+
+clock_time_t clock_time(void) {
+    return bench_clock;
+}
+
+unsigned long clock_seconds(void) {
+    return bench_clock / CLOCK_SECOND;
+}
+
+void etimer_set(struct etimer *t, clock_time_t interval) {
+    t->start = bench_clock;
+    t->interval = interval;
+}
+
+void etimer_reset(struct etimer *t) {
+    t->start += t->interval;
+}
+
+int etimer_expired(struct etimer *t) {
+    return bench_clock - t->start >= t->interval;
+}
+
+void process_poll(struct process *p) {
+    event("poll", p);
+}
+
+void process_start(struct process *p, process_data_t data) {
+    (void) data;
+    event("start", p);
+}
+
+void process_exit(struct process *p) {
+    event("exit", p);
+}
+
+static int output(const linkaddr_t *dest) {
+    struct bench_tx *tx;
+    if (bench_tx_count == BENCH_MAX_LOG || nullnet_len > BENCH_MAX_FRAME) {
+        bench_overflow = true;
+        return 0;
+    }
+    tx = &bench_tx_log[bench_tx_count++];
+    tx->broadcast = dest == NULL;
+    memcpy(&tx->dest, dest == NULL ? &linkaddr_null : dest, sizeof(linkaddr_t));
+    tx->len = nullnet_len;
+    memcpy(tx->data, nullnet_buf, nullnet_len);
+    return 1;
+}
+
+const struct network_driver NETSTACK_NETWORK = { output };
+
+void nullnet_set_input_callback(nullnet_input_callback callback) {
+    // traces name the callback they deliver to
+    (void) callback;
+}
+
+unsigned short random_rand(void) {
+    // the same sequence in every run, 0 first so traces can predict the first draw
+    static unsigned short state = 0;
+    unsigned short value = state;
+    state = state * 25173 + 13849;
+    return value;
+}
+
+int serial_line_input_byte(unsigned char c) {
+    (void) c;
+    return 0;
+}
+
+void uart0_set_input(int (*input)(unsigned char c)) {
+    (void) input;
+}
@@ -0,0 +1,71 @@
+/* sensor.c under the bench, see bench.h */
+#include "sensor.c"
+#include "bench.h"
+
+const char *bench_firmware = "sensor";
+
+const struct bench_callback bench_callbacks[] = {
+    { "setup", input_callback_setup },
+    { "coordinator", input_callback_coordinator },
+    { "sensor", input_callback_sensor },
+    { NULL, NULL }
+};
+
+static void call_become_coordinator(long arg) { (void) arg; become_coordinator(); }
+static void call_send_unchanged(long arg) { (void) arg; send_unchanged(); }
+static void call_remove_child(long arg) { remove_child(arg); }
+static void call_remove_missing_children(long arg) { (void) arg; remove_missing_children(); }
+static void call_add_sample(long arg) { add_sample(arg); }
+static void call_check_alarm(long arg) { check_alarm(arg); }
+static void call_alarm_delay(long arg) { (void) arg; printf("alarm_delay %ld\n", (long) alarm_delay()); }
+static void call_send_alarm(long arg) { (void) arg; send_alarm(); }
+
+const struct bench_call bench_calls[] = {
+    { "become_coordinator", call_become_coordinator },
+    { "send_unchanged", call_send_unchanged },
+    { "remove_child", call_remove_child },
+    { "remove_missing_children", call_remove_missing_children },
+    { "add_sample", call_add_sample },
+    { "check_alarm", call_check_alarm },
+    { "alarm_delay", call_alarm_delay },
+    { "send_alarm", call_send_alarm },
+    { NULL, NULL }
+};
+
+const struct bench_var bench_vars[] = {
+    BENCH_VAR(type),
+    BENCH_ADDR(parent),
+    BENCH_VAR(retries),
+    BENCH_VAR(last_poll),
+    BENCH_VAR(window_number),
+    BENCH_VAR(window_start),
+    BENCH_VAR(window_allotted),
+    BENCH_VAR(clock_round),
+    BENCH_VAR(waiting_for_clock),
+    BENCH_VAR(clock_offset),
+    BENCH_VAR(role.setup.coord_candidate_index),
+    BENCH_VAR(role.setup.sensor_candidate_index),
+    BENCH_VAR(role.coordinator.children_size),
+    BENCH_ADDR(role.coordinator.current_child),
+    BENCH_VAR(role.coordinator.child_done),
+    BENCH_VAR(role.coordinator.polled),
+    BENCH_VAR(role.coordinator.missing),
+    BENCH_VAR(role.coordinator.unchanged),
+    BENCH_VAR(role.coordinator.window),
+    BENCH_VAR(role.sensor.window),
+    BENCH_VAR(role.sensor.seq),
+    BENCH_VAR(role.sensor.count),
+    BENCH_VAR(role.sensor.changed),
+    BENCH_VAR(role.sensor.reported_mean),
+    BENCH_VAR(role.sensor.alarm_pending),
+    BENCH_VAR(role.sensor.alarm_slot),
+    { NULL, NULL, 0, false, false }
+};
+
+void bench_boot(void) {
+    // as setup_process before it waits for the candidates
+    type = -1;
+    memset(&role, 0, sizeof(role));
+    nullnet_buf = (uint8_t *) &message;
+    nullnet_len = MESSAGE_SIZE;
+}
@@ -10,6 +10,7 @@
 #include "dev/slip.h"
 #include "dev/serial-line.h"
 #include "cpu/msp430/dev/uart0.h"
+#include "protocol.h"
 #define LOG_MODULE "App"
 #define LOG_LEVEL LOG_LEVEL_INFO
 
@@ -17,9 +18,12 @@
 
 #define WINDOW_SIZE 2000 // window size in milliseconds
 #define MAX_COORDINATOR 4 // maximum number of coordinators
-#define MAX_SENSORS  16// maximum number of sensors
+#define MAX_SENSORS  16// maximum number of sensors (at most 32, see reported)
 #define WAIT_SYNC 1000 // time to wait for synchronization
 #define DELAY 1000 // delay between messages
+#define SYNC_TIMEOUT 250 // time to wait for the clock replies before asking again (in ticks)
+#define SYNC_RETRIES 2 // number of times a missing clock reply is requested again
+#define CONTROL_REPEAT 2 // number of copies of the broadcast control frames (duplicates are dropped)
 
 /*---------------------------------------------------------------------------*/
 
@@ -28,59 +32,99 @@ AUTOSTART_PROCESSES(&init);
 
 /*---------------------------------------------------------------------------*/
 
-static bool address_received = false; // flag to indicate if the address of a sensor was received
-static linkaddr_t last_sensor; // address of the last sensor from which a message was received
 static linkaddr_t sensors[MAX_SENSORS]; // list of sensors addresses
 static int number_of_sensors = 0; // number of sensors
 static int count_of_sensors[MAX_SENSORS]; // list of counts of the sensors
-static int last_count = 0; // count of the last sensor from which a message was received
+static int last_seq[MAX_SENSORS]; // sequence number of the last reading of the sensors
+static int last_alarm_seq[MAX_SENSORS]; // sequence number of the last alarm of the sensors
+static uint32_t sampled_at[MAX_SENSORS]; // synchronized times of the last reading of the sensors: when it was sampled,
+static uint32_t forwarded_at[MAX_SENSORS]; // forwarded by its coordinator
+static uint32_t received_at[MAX_SENSORS]; // and received by the border
+static linkaddr_t forwarded_by[MAX_SENSORS]; // coordinator that forwarded the last reading of the sensors
+static uint32_t reported = 0; // bitmap of the sensors that reported in the current window
+static uint32_t unchanged = 0; // bitmap of the sensors whose readings did not change in the current window
+_Static_assert(MAX_SENSORS <= 8 * sizeof(reported), "MAX_SENSORS does not fit the sensor bitmaps");
+static uint8_t window_number = 0; // number of the current window
 static linkaddr_t coordinator_list[MAX_COORDINATOR]; // list of coordinators addresses
 static linkaddr_t pending_list[MAX_COORDINATOR]; // list of pending coordinators addresses
 static int number_of_coordinators = 0; // number of coordinators
 static int number_of_pending = 0; // number of pending coordinators
 static uint32_t average_clock = 0; // average clock time of the coordinators
 static bool waiting_for_sync = false; // flag to indicate if the node is waiting for synchronization
-static int clock_received = 0; // number of clock times received
+static uint32_t clock_received = 0; // bitmap of the coordinators whose clock time was received
+static uint8_t clock_round = 0; // number of the current synchronization round
 static uint32_t coordinator_clock[MAX_COORDINATOR]; // clock times of the coordinators
 static uint32_t offset = 0; //offset of the border with the calculated average clock
 static uint32_t timeslots[MAX_COORDINATOR]; // timeslots of the coordinators
 static uint32_t timeslot_start[MAX_COORDINATOR] ; // start time of the timeslot
+static uint32_t alarm_start = 0; // start time of the alarm slot, after the timeslots
 static int receiving_from = -1; // index of the coordinator from which the node is receiving
 static int number_of_messages = 0; // number of messages received per window
 static bool stop = false; // flag to indicate if the node should exit
-static int state = -1; // 0 : setup, 1 : synchronization, 2 : timeslotting, 3 : collection
+static char tx_buffer[MESSAGE_SIZE + 1]; // radio buffer the init process sends from, as large as the frames received
+static int state = -1; // 0 : setup, 1 : synchronization, 2 : timeslotting, 3 : collection, 4 : alarm slot
 
 /*---------------------------------------------------------------------------*/
-void assign_last_counts() {
-    //if a sensor is not in the list, add it
-    for (int i = 0; i <= number_of_sensors; i++) {
-        if (linkaddr_cmp(&sensors[i], &last_sensor)) {
-            count_of_sensors[i] = last_count;
+int sensor_index(const linkaddr_t *sensor) {
+    //index of the sensor in the list, added if it is not in the list yet
+    for (int i = 0; i < number_of_sensors; i++) {
+        if (linkaddr_cmp(&sensors[i], sensor)) {
+            return i;
         }
-        if (i == number_of_sensors - 1) {
-            memcpy(&sensors[number_of_sensors], &last_sensor, sizeof(linkaddr_t));
-            count_of_sensors[number_of_sensors] = last_count;
-            number_of_sensors++;
-        }
-        if (number_of_sensors == 0) {
-            memcpy(&sensors[number_of_sensors], &last_sensor, sizeof(linkaddr_t));
-            count_of_sensors[number_of_sensors] = last_count;
-            number_of_sensors++;
+    }
+    if (number_of_sensors == MAX_SENSORS) {
+        return -1;
+    }
+    memcpy(&sensors[number_of_sensors], sensor, sizeof(linkaddr_t));
+    last_seq[number_of_sensors] = -1;
+    last_alarm_seq[number_of_sensors] = -1;
+    return number_of_sensors++;
+}
+
+int coordinator_index(const linkaddr_t *coordinator) {
+    for (int i = 0; i < number_of_coordinators; i++) {
+        if (linkaddr_cmp(&coordinator_list[i], coordinator)) {
+            return i;
         }
     }
+    return -1;
+}
+
+uint32_t get_clock() {
+    //synchronized clock of the network
+    return (uint32_t) (clock_time() + offset);
+}
+
+void uplink(const char *kind, const linkaddr_t *sensor, int value, const linkaddr_t *coordinator,
+            uint32_t sampled, uint32_t forwarded, uint32_t received) {
+    //"<kind> <sensor> <value> <coordinator> <sampled> <forwarded> <received> <uplinked>", times in ticks of the synchronized clock
+    printf("%s %d.%d %d %d.%d %lu %lu %lu %lu\n", kind, sensor->u8[0], sensor->u8[1], value,
+           coordinator->u8[0], coordinator->u8[1], (unsigned long) sampled, (unsigned long) forwarded,
+           (unsigned long) received, (unsigned long) get_clock());
 }
 
 void send_sensor_data(){
-    for (int i = 0; i <= number_of_sensors; i++) {
-        uart0_writeb((unsigned char) i);
-        uart0_writeb((unsigned char) count_of_sensors[i]);
+    // one text record per sensor that reported in the last window, parsed by the host (server.py --store);
+    // called once the next window was sent, so the last window is window_number - 1
+    for (int i = 0; i < number_of_sensors; i++) {
+        if (reported & ((uint32_t) 1 << i)) {
+            uplink("DATA", &sensors[i], count_of_sensors[i], &forwarded_by[i], sampled_at[i], forwarded_at[i], received_at[i]);
+        } else if (!(unchanged & ((uint32_t) 1 << i))) {
+            LOG_INFO("BORDER | No reading from %d.%d in window %d\n", sensors[i].u8[0], sensors[i].u8[1], (uint8_t) (window_number - 1));
+        }
     }
+    reported = 0;
+    unchanged = 0;
 }
 
 void input_callback(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest) {
-    static char message[20];
+    static char message[MESSAGE_SIZE + 1];
     static linkaddr_t source;
     memcpy(&source, src, sizeof(linkaddr_t));
+    if (len > MESSAGE_SIZE) {
+        len = MESSAGE_SIZE;
+    }
+    memset(message, 0, sizeof(message));
     memcpy(message, data, len);
     LOG_INFO("BORDER | Received message from %d.%d: '%s'\n", source.u8[0], source.u8[1], message);
     if (strcmp(message, "coordinator") == 0){
@@ -101,38 +145,109 @@ void input_callback(const void *data, uint16_t len, const linkaddr_t *src, const
         LOG_INFO("BORDER | Received ping message from %d.%d\n", source.u8[0], source.u8[1]);
         number_of_messages++;
     }
-    else if (strcmp(message, "sensor") == 0){
-        LOG_INFO("BORDER | received sensor message from %d.%d\n", source.u8[0], source.u8[1]);
-        address_received = false;
+    else if (strcmp(message, "alarm") == 0){
+        //an urgent reading, written to the uart at once instead of waiting for the next batch
+        struct data_frame alarm;
+        linkaddr_t sensor; // copied out of the packed frame, linkaddr_t may need alignment
+        if (!frame_payload(message, len, &alarm, sizeof(alarm))) {
+            return;
+        }
+        memcpy(&sensor, &alarm.sensor, sizeof(linkaddr_t));
+        int i = sensor_index(&sensor);
+        if (i < 0 || alarm.seq == last_alarm_seq[i]) {
+            return;
+        }
+        last_alarm_seq[i] = alarm.seq;
+        uplink("ALARM", &sensor, alarm.value, &source, alarm.sampled, alarm.forwarded, get_clock());
+    }
+    else if (strcmp(message, "data") == 0){
+        //a reading forwarded by a coordinator, retransmissions carry the same sequence number
+        struct data_frame reading;
+        linkaddr_t sensor;
+        if (!frame_payload(message, len, &reading, sizeof(reading))) {
+            return;
+        }
+        memcpy(&sensor, &reading.sensor, sizeof(linkaddr_t));
+        int i = sensor_index(&sensor);
+        if (i < 0 || reading.seq == last_seq[i]) {
+            return;
+        }
+        LOG_INFO("BORDER | Received count from %d.%d\n", sensor.u8[0], sensor.u8[1]);
+        last_seq[i] = reading.seq;
+        count_of_sensors[i] = reading.value;
+        sampled_at[i] = reading.sampled;
+        forwarded_at[i] = reading.forwarded;
+        received_at[i] = get_clock();
+        memcpy(&forwarded_by[i], &source, sizeof(linkaddr_t));
+        reported |= (uint32_t) 1 << i;
+        number_of_messages++;
+    }
+    else if (strcmp(message, "agg") == 0){
+        //the window aggregate of a sensor in report-by-exception mode, uplinked as its mean
+        struct aggregate_frame aggregate;
+        linkaddr_t sensor;
+        if (!frame_payload(message, len, &aggregate, sizeof(aggregate))) {
+            return;
+        }
+        memcpy(&sensor, &aggregate.sensor, sizeof(linkaddr_t));
+        int i = sensor_index(&sensor);
+        if (i < 0 || aggregate.seq == last_seq[i]) {
+            return;
+        }
+        LOG_INFO("BORDER | Received aggregate from %d.%d (%d samples)\n", sensor.u8[0], sensor.u8[1], aggregate.count);
+        last_seq[i] = aggregate.seq;
+        count_of_sensors[i] = aggregate.mean;
+        sampled_at[i] = aggregate.sampled;
+        forwarded_at[i] = aggregate.forwarded;
+        received_at[i] = get_clock();
+        memcpy(&forwarded_by[i], &source, sizeof(linkaddr_t));
+        reported |= (uint32_t) 1 << i;
+        number_of_messages++;
+    }
+    else if (strcmp(message, "same") == 0){
+        //sensors that were polled but whose readings did not change, nothing to uplink for them
+        linkaddr_t sensor;
+        for (uint16_t k = sizeof("same"); k + sizeof(linkaddr_t) <= len; k += sizeof(linkaddr_t)) {
+            memcpy(&sensor, &message[k], sizeof(linkaddr_t));
+            int i = sensor_index(&sensor);
+            if (i >= 0) {
+                unchanged |= (uint32_t) 1 << i;
+            }
+        }
         number_of_messages++;
     }
     else if (strcmp(message, "stop") == 0){
         LOG_INFO("BORDER | received stop message from %d.%d\n", source.u8[0], source.u8[1]);
         stop = true; // stop the border
     }
-    else{
-        if(waiting_for_sync && (strcmp(message,"new") != 0)){
-            //if the node is waiting for synchronization and the message is not a new message, it means that the message is a clock time
-            LOG_INFO("BORDER | Received clock time from %d.%d\n", source.u8[0], source.u8[1]);
-            memcpy(&coordinator_clock[clock_received], message, sizeof(uint32_t));
-            clock_received++;
-            if(clock_received == number_of_coordinators){
-                waiting_for_sync = false;
-                LOG_INFO("BORDER | Received all clock times\n");
-            }
-            process_poll(&init);
+    else if (strcmp(message, "clock") == 0 && waiting_for_sync){
+        //clock time of a coordinator, answering the current synchronization round
+        struct clock_frame clock;
+        int i = coordinator_index(&source);
+        if (i < 0 || !frame_payload(message, len, &clock, sizeof(clock)) || clock.round != clock_round) {
+            return;
         }
-        else if(address_received && (strcmp(message,"new") != 0)){
-            //if the address is already received , then the message is the count
-            LOG_INFO("BORDER | Received count from %d.%d\n", last_sensor.u8[0], last_sensor.u8[1]);
-            last_count = atoi(message);
+        LOG_INFO("BORDER | Received clock time from %d.%d\n", source.u8[0], source.u8[1]);
+        coordinator_clock[i] = clock.clock;
+        clock_received |= (uint32_t) 1 << i;
+        if(clock_received == ((uint32_t) 1 << number_of_coordinators) - 1){
+            waiting_for_sync = false;
+            LOG_INFO("BORDER | Received all clock times\n");
+            process_poll(&init);
         }
-        else if(!address_received && (strcmp(message,"new") != 0)){
-            //if the message is a new message, then the next message will be the address
-            LOG_INFO("BORDER | Received address %s from %d.%d\n", message, source.u8[0], source.u8[1]);
-            memcpy(&last_sensor, src, sizeof(linkaddr_t));
-            address_received = true;
+    }
+}
+
+void request_clocks(){
+    //send clock_request to the coordinators whose clock time was not received yet
+    struct clock_frame request = { clock_round, 0 };
+    for (int i = 0; i < number_of_coordinators; i++){
+        if (clock_received & ((uint32_t) 1 << i)) {
+            continue;
         }
+        LOG_INFO("BORDER | Sending clock_request to %d.%d\n", coordinator_list[i].u8[0], coordinator_list[i].u8[1]);
+        nullnet_len = frame_build(nullnet_buf, "clock_request", &request, sizeof(request));
+        NETSTACK_NETWORK.output(&coordinator_list[i]);
     }
 }
 
@@ -140,33 +255,24 @@ void synchronization(){
     LOG_INFO("BORDER | starting synchronization\n");
     state = 1;
     memset(coordinator_clock, 0, sizeof(coordinator_clock));
-    //send clock_request to all coordinators
-    for (int i = 0; i < number_of_coordinators; i++){
-        memcpy(nullnet_buf, "clock_request", sizeof("clock_request"));
-        LOG_INFO("BORDER | Sending clock_request to %d.%d\n", coordinator_list[i].u8[0], coordinator_list[i].u8[1]);
-        nullnet_len = sizeof("clock_request");
-        NETSTACK_NETWORK.output(&coordinator_list[i]);
-    }
-    //send clock_request to all pending coordinators
+    //add the pending coordinators to the coordinator list
     for (int i = 0; i < number_of_pending; i++){
-        memcpy(nullnet_buf, "clock_request", sizeof("clock_request"));
-        LOG_INFO("BORDER | Sending clock_request to %d.%d\n", pending_list[i].u8[0], pending_list[i].u8[1]);
-        nullnet_len = sizeof("clock_request");
-        NETSTACK_NETWORK.output(&pending_list[i]);
-        //remove coordinator from the pending list and add it to the coordinator list
-        memcpy(&coordinator_list[number_of_coordinators], &pending_list[i], sizeof(&pending_list[i]));
+        memcpy(&coordinator_list[number_of_coordinators], &pending_list[i], sizeof(linkaddr_t));
         number_of_coordinators++;
     }
-    waiting_for_sync = true;
     number_of_pending = 0;
     memset(&pending_list, 0, sizeof(pending_list));
-
+    //send clock_request to all coordinators
+    clock_round++;
+    clock_received = 0;
+    waiting_for_sync = true;
+    request_clocks();
 }
 
 void timeslotting() {
     LOG_INFO("BORDER | starting timeslotting\n");
     state = 2;
-    //divide the window into timeslots
+    //divide the window into timeslots, the alarm slot comes after the window
     for (int i = 0; i < number_of_coordinators; i++){
         timeslots[i] = WINDOW_SIZE / number_of_coordinators;
     }
@@ -175,30 +281,27 @@ void timeslotting() {
         timeslot_start[i] = (i * timeslots[i]) + clock_time() + DELAY + offset;
         LOG_INFO("BORDER | timeslot %d starts at %d\n", i, (int)timeslot_start[i]);
     }
+    alarm_start = timeslot_start[number_of_coordinators - 1] + timeslots[number_of_coordinators - 1];
 }
 
 void sendTimeslots(){
     static int i;
     static linkaddr_t coordinator;
+    static struct window_frame window;
+    window_number++;
     for (i = 0; i < number_of_coordinators; i++){
         coordinator = coordinator_list[i];
-        memcpy(nullnet_buf, &timeslot_start[i], sizeof(timeslot_start[i]));
         LOG_INFO("BORDER | Sending timeslot to %d.%d\n", coordinator.u8[0], coordinator.u8[1]);
 
-        //sending window message
-        memcpy(nullnet_buf, "window", sizeof("window"));
-        nullnet_len = sizeof("window");
-        NETSTACK_NETWORK.output(&coordinator);
-
-        //sending timeslot_start
-        memcpy(nullnet_buf, &timeslot_start[i], sizeof(timeslot_start[i]));
-        nullnet_len = sizeof(timeslot_start[i]);
-        NETSTACK_NETWORK.output(&coordinator);
-
-        //sending timeslot
-        memcpy(nullnet_buf, &timeslots[i], sizeof(timeslots[i]));
-        nullnet_len = sizeof(timeslots[i]);
-        NETSTACK_NETWORK.output(&coordinator);
+        //sending window message with the timeslot start and the timeslot, repeated copies are dropped by the window number
+        window.window = window_number;
+        window.start = timeslot_start[i];
+        window.allotted = timeslots[i];
+        window.alarm = alarm_start;
+        for (int k = 0; k < CONTROL_REPEAT; k++){
+            nullnet_len = frame_build(nullnet_buf, "window", &window, sizeof(window));
+            NETSTACK_NETWORK.output(&coordinator);
+        }
     }
 }
 
@@ -208,18 +311,19 @@ PROCESS_THREAD(init, ev, data){
     PROCESS_BEGIN();
     uart0_set_input(serial_line_input_byte);
     LOG_INFO("BORDER | init process started with address %d%d\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
-    static char message[20];
     static struct etimer timer;
-    nullnet_buf = (uint8_t *)&message;
-    nullnet_len = sizeof(message);
+    static struct clock_frame sync_clock;
+    static int sync_attempts;
+    static int clocks;
+    nullnet_buf = (uint8_t *)&tx_buffer;
+    nullnet_len = MESSAGE_SIZE;
     nullnet_set_input_callback(input_callback);
     //send a message to all the nodes to start the setup process
     state = 0;
     LOG_INFO("BORDER | broadcasting border message\n");
-    memcpy(message, "border", sizeof("border"));
+    memcpy(tx_buffer, "border", sizeof("border"));
     for (int i = 0; i < 20; i++){
-        memcpy(nullnet_buf, &message, sizeof(message));
-        nullnet_len = sizeof(message);
+        nullnet_len = sizeof("border");
         NETSTACK_NETWORK.output(NULL);
     }
     PROCESS_WAIT_EVENT_UNTIL(number_of_coordinators > 0 || number_of_pending > 0);
@@ -227,20 +331,38 @@ PROCESS_THREAD(init, ev, data){
         synchronization();
         average_clock = 0;
         LOG_INFO("BORDER | Waiting for clock\n");
-        PROCESS_WAIT_EVENT_UNTIL(!waiting_for_sync || ev == PROCESS_EVENT_POLL);
+        //ask again the coordinators whose clock time is missing, then go on with the ones received
+        sync_attempts = 0;
+        etimer_set(&timer, SYNC_TIMEOUT);
+        PROCESS_WAIT_EVENT_UNTIL(!waiting_for_sync || etimer_expired(&timer));
+        while (waiting_for_sync && sync_attempts < SYNC_RETRIES){
+            sync_attempts++;
+            LOG_INFO("BORDER | Missing clock times, retry %d\n", sync_attempts);
+            request_clocks();
+            etimer_set(&timer, SYNC_TIMEOUT);
+            PROCESS_WAIT_EVENT_UNTIL(!waiting_for_sync || etimer_expired(&timer));
+        }
+        waiting_for_sync = false;
         //calculate average clock time
+        clocks = 1;
         for (int i = 0; i < number_of_coordinators; i++){
-            average_clock += (uint32_t) coordinator_clock[i];
+            if (clock_received & ((uint32_t) 1 << i)) {
+                average_clock += (uint32_t) coordinator_clock[i];
+                clocks++;
+            }
         }
         average_clock += (uint32_t) clock_time();
         // log the number of coordinators
-        average_clock = average_clock/(number_of_coordinators + 1);
+        average_clock = average_clock/clocks;
         //calculate the offset between own clock and average clock
         offset = (uint32_t) (average_clock - clock_time());
         LOG_INFO("BORDER | Sending new clocktime (%d, %d)\n", (int) clock_time(), (int) average_clock);
-        memcpy(nullnet_buf, &average_clock, sizeof(average_clock));
-        nullnet_len = sizeof(average_clock);
-        NETSTACK_NETWORK.output(NULL);
+        sync_clock.round = clock_round;
+        sync_clock.clock = average_clock;
+        for (int k = 0; k < CONTROL_REPEAT; k++){
+            nullnet_len = frame_build(nullnet_buf, "clock", &sync_clock, sizeof(sync_clock));
+            NETSTACK_NETWORK.output(NULL);
+        }
 
         //free coordinator clock list
         memset(coordinator_clock, 0, sizeof(coordinator_clock));
@@ -268,7 +390,8 @@ PROCESS_THREAD(init, ev, data){
         state = 3;
         LOG_INFO("BORDER | Starting window\n");
         //update the receiving from coordinator list
-        static int i2 = 0;
+        static int i2;
+        i2 = 0;
         while (i2 < number_of_coordinators){
             receiving_from = i2;
             LOG_INFO("BORDER | Receiving from %d.%d\n", coordinator_list[i2].u8[0], coordinator_list[i2].u8[1]);
@@ -278,6 +401,10 @@ PROCESS_THREAD(init, ev, data){
             number_of_messages = 0;
             i2++;
         }
+        //no coordinator is scheduled in the alarm slot, sensors can get their alarms through
+        state = 4;
+        etimer_set(&timer, ALARM_SLOT);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&timer));
         LOG_INFO("BORDER | Window finished\n");
         state = -1;
     }
@@ -0,0 +1,153 @@
+import argparse
+import socket
+import sys
+import time
+
+# End-to-end latency report of the readings uplinked by the border node.
+#
+# Border records are
+#   <DATA|ALARM> <sensor> <value> <coordinator> <sampled> <forwarded> <received> <uplinked>
+# with times in ticks of the synchronized network clock: when the sensor
+# sampled the value, when its coordinator forwarded it, when the border
+# received it and when the border wrote it to the uart. The host clock is not
+# synchronized with the network, so the border -> host hop is measured
+# relative to the fastest record seen (its lower bound is 0).
+
+HOPS = ["sensor->coordinator", "coordinator->border", "border queue", "border->host", "end-to-end"]
+
+
+def ticks(later, earlier):
+    # difference of two uint32 clock values, negative if the clocks disagree
+    d = (later - earlier) % (1 << 32)
+    return d - (1 << 32) if d >= (1 << 31) else d
+
+
+class Histogram:
+    def __init__(self):
+        self.samples = []
+
+    def add(self, ms):
+        self.samples.append(ms)
+
+    def summary(self):
+        ordered = sorted(self.samples)
+        n = len(ordered)
+        p50 = ordered[n // 2]
+        p99 = ordered[min(n - 1, int(n * 0.99))]
+        return "n=%-6d p50=%8.1fms p99=%8.1fms max=%8.1fms" % (n, p50, p99, ordered[-1])
+
+    def buckets(self):
+        # counts per power-of-two bucket of milliseconds
+        counts = {}
+        for ms in self.samples:
+            bound = 1
+            while bound < ms:
+                bound *= 2
+            counts[bound] = counts.get(bound, 0) + 1
+        return " ".join("<=%dms:%d" % (bound, counts[bound]) for bound in sorted(counts))
+
+
+class LatencyReport:
+    def __init__(self, clock_second):
+        self.ms_per_tick = 1000.0 / clock_second
+        self.records = []  # (kind, sensor, coordinator, hops in ms, host - uplinked in ms)
+        self.skipped = 0
+
+    def add(self, line, host_ms=None):
+        fields = line.split()
+        if len(fields) != 8 or fields[0] not in ("DATA", "ALARM"):
+            return False
+        try:
+            sampled, forwarded, received, uplinked = (int(f) for f in fields[4:])
+        except ValueError:
+            self.skipped += 1
+            return False
+        ms = self.ms_per_tick
+        hops = {
+            "border queue": ticks(uplinked, received) * ms,
+            "end-to-end": ticks(uplinked, sampled) * ms,
+        }
+        if forwarded != 0:
+            hops["sensor->coordinator"] = ticks(forwarded, sampled) * ms
+            hops["coordinator->border"] = ticks(received, forwarded) * ms
+        uplink = host_ms - uplinked * ms if host_ms is not None else None
+        self.records.append((fields[0], fields[1], fields[3], hops, uplink))
+        return True
+
+    def groups(self):
+        uplinks = [r[4] for r in self.records if r[4] is not None]
+        fastest = min(uplinks) if uplinks else 0
+        groups = {}
+        for kind, sensor, coordinator, hops, uplink in self.records:
+            hops = dict(hops)
+            if uplink is not None:
+                hops["border->host"] = uplink - fastest
+                hops["end-to-end"] += hops["border->host"]
+            for hop, value in hops.items():
+                groups.setdefault(("hop", "%s %s" % (kind, hop)), Histogram()).add(value)
+            groups.setdefault(("sensor", "%s %s" % (kind, sensor)), Histogram()).add(hops["end-to-end"])
+            groups.setdefault(("coordinator", "%s %s" % (kind, coordinator)), Histogram()).add(hops["end-to-end"])
+        return groups
+
+    def print(self, out=sys.stdout):
+        groups = self.groups()
+        order = {hop: i for i, hop in enumerate(HOPS)}
+        for section in ("hop", "coordinator", "sensor"):
+            keys = [k for k in groups if k[0] == section]
+            if section == "hop":
+                keys.sort(key=lambda k: (k[1].split(" ", 1)[0], order[k[1].split(" ", 1)[1]]))
+            else:
+                keys.sort()
+            if not keys:
+                continue
+            out.write("-- end-to-end latency per %s\n" % section if section != "hop" else "-- latency per hop\n")
+            for key in keys:
+                out.write("%-32s %s\n" % (key[1], groups[key].summary()))
+                if section == "hop" and key[1].endswith("end-to-end"):
+                    out.write("%-32s %s\n" % ("", groups[key].buckets()))
+        if self.skipped:
+            out.write("%d malformed records skipped\n" % self.skipped)
+        out.flush()
+
+
+def read_socket(ip, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect((ip, port))
+    for line in sock.makefile("r", encoding="utf-8", errors="replace"):
+        yield line, time.time() * 1000
+
+
+def read_file(path):
+    # a capture has no host arrival times, the border -> host hop is left out
+    with (sys.stdin if path == "-" else open(path, encoding="utf-8", errors="replace")) as f:
+        for line in f:
+            yield line, None
+
+
+def main(args):
+    report = LatencyReport(args.clock_second)
+    lines = read_file(args.file) if args.file else read_socket(args.ip, args.port)
+    last = time.monotonic()
+    try:
+        for line, host_ms in lines:
+            report.add(line, host_ms)
+            if args.report_every and time.monotonic() - last >= args.report_every and report.records:
+                report.print()
+                last = time.monotonic()
+    except KeyboardInterrupt:
+        pass
+    if report.records:
+        report.print()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--ip", dest="ip", type=str)
+    parser.add_argument("--port", dest="port", type=int)
+    parser.add_argument("--file", dest="file", type=str, help="border output capture, - for stdin")
+    parser.add_argument("--clock-second", dest="clock_second", type=int, default=128, help="CLOCK_SECOND of the motes")
+    parser.add_argument("--report-every", dest="report_every", type=float, default=60, help="seconds between reports, 0 for only at the end")
+    args = parser.parse_args()
+    if not (args.file or (args.ip and args.port)):
+        parser.error("one of --file or --ip/--port is required")
+    main(args)
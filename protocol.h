@@ -0,0 +1,121 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include "contiki.h"
+#include <string.h>
+
+/*
+ * Frames exchanged between sensors, coordinators and the border node.
+ *
+ * A frame is a NUL-terminated keyword ("poll", "data", ...) optionally
+ * followed by a binary payload, so receivers keep dispatching on strcmp()
+ * of the keyword and read the payload with frame_payload().
+ */
+
+#define ALARM_REPEAT 2 // number of copies of an alarm frame (duplicates are dropped)
+#define ALARM_SLOT 200 // contention slot for alarms, after the timeslots of the coordinators (in ticks)
+
+/* one-byte reply (no NUL, receivers terminate frames on copy) of a sensor
+ * whose readings did not change since its last report */
+#define UNCHANGED "="
+
+/* "clock_request" (border -> coordinator) and "clock" (both directions) */
+struct clock_frame {
+    uint8_t round; // synchronization round, replies from older rounds are dropped
+    uint32_t clock;
+} __attribute__((packed));
+
+/* "window" (border -> coordinator) */
+struct window_frame {
+    uint8_t window; // window number, repeated frames are dropped
+    uint32_t start;
+    uint32_t allotted;
+    uint32_t alarm; // start of the alarm slot of the window
+} __attribute__((packed));
+
+/* "poll" (coordinator -> sensor) and "done" (sensor -> coordinator) */
+struct poll_frame {
+    uint8_t window; // a second poll in the same window asks for a retransmission
+    uint8_t count; // number of data frames sent (done only)
+    uint32_t clock; // synchronized clock of the coordinator, sensors set theirs from it (poll only)
+    uint32_t alarm; // start of the alarm slot of the window, sensors send their alarms in it (poll only)
+} __attribute__((packed));
+
+/* "data" (sensor -> coordinator -> border), also the payload of "alarm" frames,
+ * which a sensor sends unsolicited in the alarm slot and coordinators forward
+ * at once; alarms have their own sequence numbers */
+struct data_frame {
+    linkaddr_t sensor; // sensor that produced the value
+    uint8_t seq; // per-sensor sequence number, retransmissions reuse it
+    int16_t value;
+    uint32_t sampled; // synchronized clock of the sensor when the value was sampled
+    uint32_t forwarded; // synchronized clock of the coordinator when it forwarded the frame, must stay last
+} __attribute__((packed));
+
+/* "agg" (sensor -> coordinator -> border), report-by-exception mode */
+struct aggregate_frame {
+    linkaddr_t sensor;
+    uint8_t seq; // shares the sequence numbers of the data frames
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+    uint8_t count; // number of samples in the window, saturated at 255
+    uint32_t sampled; // synchronized clock of the sensor at the last sample of the window
+    uint32_t forwarded; // as in struct data_frame, must stay last
+} __attribute__((packed));
+
+/* size of a frame: keyword, its NUL and the payload */
+#define FRAME_SIZE(keyword, payload) (sizeof(keyword) + sizeof(payload))
+#define FRAME_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* size of the radio buffers, the largest frame (it depends on LINKADDR_SIZE) */
+#define MESSAGE_SIZE FRAME_MAX(FRAME_MAX(FRAME_SIZE("clock_request", struct clock_frame), \
+                                         FRAME_SIZE("window", struct window_frame)), \
+                               FRAME_MAX(FRAME_MAX(FRAME_SIZE("poll", struct poll_frame), \
+                                                   FRAME_SIZE("alarm", struct data_frame)), \
+                                         FRAME_MAX(FRAME_SIZE("data", struct data_frame), \
+                                                   FRAME_SIZE("agg", struct aggregate_frame))))
+
+_Static_assert(FRAME_SIZE("clock_request", struct clock_frame) <= MESSAGE_SIZE, "clock_request frame too large");
+_Static_assert(FRAME_SIZE("clock", struct clock_frame) <= MESSAGE_SIZE, "clock frame too large");
+_Static_assert(FRAME_SIZE("window", struct window_frame) <= MESSAGE_SIZE, "window frame too large");
+_Static_assert(FRAME_SIZE("poll", struct poll_frame) <= MESSAGE_SIZE, "poll frame too large");
+_Static_assert(FRAME_SIZE("done", struct poll_frame) <= MESSAGE_SIZE, "done frame too large");
+_Static_assert(FRAME_SIZE("data", struct data_frame) <= MESSAGE_SIZE, "data frame too large");
+_Static_assert(FRAME_SIZE("alarm", struct data_frame) <= MESSAGE_SIZE, "alarm frame too large");
+_Static_assert(FRAME_SIZE("agg", struct aggregate_frame) <= MESSAGE_SIZE, "agg frame too large");
+_Static_assert(sizeof("coordinator") <= MESSAGE_SIZE, "coordinator frame too large");
+
+/* "same" (coordinator -> border): addresses of the children that replied UNCHANGED */
+#define SAME_PER_FRAME ((MESSAGE_SIZE - sizeof("same")) / sizeof(linkaddr_t))
+
+static inline uint16_t frame_build(void *buf, const char *keyword, const void *payload, uint16_t len) {
+    // write keyword and payload to buf (a radio buffer of MESSAGE_SIZE bytes),
+    // return the length of the frame, 0 if it does not fit
+    uint16_t keyword_len = strlen(keyword) + 1;
+    if (keyword_len + len > MESSAGE_SIZE) {
+        return 0;
+    }
+    memcpy(buf, keyword, keyword_len);
+    memcpy((uint8_t *) buf + keyword_len, payload, len);
+    return keyword_len + len;
+}
+
+static inline void frame_stamp_forwarded(void *buf, uint16_t len, uint32_t time) {
+    // "data", "agg" and "alarm" frames end with the forwarded time, set by the coordinator
+    if (len >= sizeof(time)) {
+        memcpy((uint8_t *) buf + len - sizeof(time), &time, sizeof(time));
+    }
+}
+
+static inline bool frame_payload(const void *buf, uint16_t len, void *payload, uint16_t size) {
+    // copy the payload of a received frame, false if the frame is too short
+    uint16_t keyword_len = strnlen((const char *) buf, len) + 1;
+    if (keyword_len + size > len) {
+        return false;
+    }
+    memcpy(payload, (const uint8_t *) buf + keyword_len, size);
+    return true;
+}
+
+#endif /* PROTOCOL_H_ */
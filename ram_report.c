@@ -0,0 +1,13 @@
+/*
+ * Sizes of the per-role state of sensor.c, for "make ram-report".
+ *
+ * Compiled with the target compiler but never linked: every array below is
+ * as large as the object it is named after, and nm -S prints their sizes.
+ */
+#include "sensor.c"
+
+char ram_report_role_setup[sizeof(role.setup)] = { 0 };
+char ram_report_role_coordinator[sizeof(role.coordinator)] = { 0 };
+char ram_report_role_sensor[sizeof(role.sensor)] = { 0 };
+char ram_report_role_arena[sizeof(role)] = { 0 };
+char ram_report_radio_buffer[sizeof(message)] = { 0 };
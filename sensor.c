@@ -6,6 +6,8 @@
 #include <stdio.h> /* For printf() */
 #include "cc2420.h"
 #include "cc2420_const.h"
+#include "lib/random.h"
+#include "protocol.h"
 /* Log configuration */
 #include "sys/log.h"
 
@@ -17,8 +19,23 @@
 #define MAX_RETRIES 2 // max number of retries to find a parent
 #define GATHER_TIME 2 // time to gather candidates (in seconds)
 #define MAX_WAIT 60 // max wait time for a response from parent (in seconds)
-#define MAX_CHILDREN 10 // max number of children
+#define MAX_CHILDREN 10 // max number of children (at most 32, see role.coordinator.missing)
 #define DATA_LENGTH 1 // length of data to send
+#define POLL_TIMEOUT (CLOCK_SECOND / 4) // time to wait for a "done" after a poll (in ticks)
+#define MAX_POLLS 3 // max number of polls of a child per window (first poll + re-polls)
+#define MAX_MISSES 3 // number of consecutive windows a child may miss before being removed
+#ifndef REPORT_BY_EXCEPTION
+#define REPORT_BY_EXCEPTION 0 // 1: sample locally and reply to polls with the window aggregate only when it changed
+#endif
+#ifndef ALARM_THRESHOLD
+#define ALARM_THRESHOLD 0 // samples reaching it are sent as an alarm in the next alarm slot, 0 disables alarms
+#endif
+#ifndef SAMPLE_PERIOD
+#define SAMPLE_PERIOD CLOCK_SECOND // sampling period in report-by-exception mode or with alarms (in ticks)
+#endif
+#ifndef REPORT_THRESHOLD
+#define REPORT_THRESHOLD 5 // deviation from the last reported mean that triggers a report
+#endif
 
 #define WINDOW_SIZE 2000 // window size in ticks
 #define SETUP_WINDOW 1000
@@ -32,30 +49,75 @@ PROCESS(main_sensor, "main_coordinator");
 AUTOSTART_PROCESSES(&setup_process);
 static int last_poll = 0;
 static int retries = 0;
-static linkaddr_t coord_candidate[MAX_CANDIDATE];
-static int coord_candidate_index = 0;
-static linkaddr_t sensor_candidate[MAX_CANDIDATE];
-static linkaddr_t children[MAX_CHILDREN];
-static int children_size = 0;
-static linkaddr_t current_child;
-static int sensor_candidate_index = 0;
 static linkaddr_t parent;
-static int coord_candidate_rssi[MAX_CANDIDATE];
-static int sensor_candidate_rssi[MAX_CANDIDATE];
 static int type = -1; // 0: sensor, 1: coordinator // -1 undecided
 
+// a node is only in one role at a time, so the candidate tables of the setup
+// phase and the children table of a coordinator share the same storage
+static union {
+    struct {
+        linkaddr_t coord_candidate[MAX_CANDIDATE];
+        int coord_candidate_rssi[MAX_CANDIDATE];
+        int coord_candidate_index;
+        linkaddr_t sensor_candidate[MAX_CANDIDATE];
+        int sensor_candidate_rssi[MAX_CANDIDATE];
+        int sensor_candidate_index;
+    } setup;
+    struct {
+        linkaddr_t children[MAX_CHILDREN];
+        uint8_t misses[MAX_CHILDREN]; // consecutive windows without a "done"
+        int children_size;
+        linkaddr_t current_child;
+        bool child_done; // "done" received from current_child for this poll
+        uint32_t polled; // bitmap of children polled in this window
+        uint32_t missing; // bitmap of children not yet done in this window
+        uint32_t unchanged; // bitmap of children that replied UNCHANGED in this window
+        uint8_t window; // number of the current polling window
+    } coordinator;
+    struct {
+        struct data_frame readings[DATA_LENGTH]; // kept for retransmission
+        uint8_t window; // window of the last poll
+        bool sampled; // readings holds a sample
+        uint8_t seq;
+        // report-by-exception mode
+        struct aggregate_frame aggregate; // last aggregate sent, kept for retransmission
+        bool changed; // the reply to the last poll was the aggregate, not UNCHANGED
+        bool reported; // reported_mean holds the mean of the last aggregate sent
+        int16_t reported_mean;
+        int32_t sum; // samples taken since the last poll
+        int16_t min;
+        int16_t max;
+        uint16_t count;
+        uint32_t last_sample; // time of the last sample
+        // alarms
+        bool alarm_raised; // the last sample was at or above ALARM_THRESHOLD
+        uint8_t alarm_seq;
+        struct data_frame alarm; // waiting for the alarm slot
+        bool alarm_pending;
+        uint32_t alarm_slot; // start of the alarm slot of the last poll
+        bool alarm_slot_known;
+    } sensor;
+} role;
+_Static_assert(MAX_CHILDREN <= 8 * sizeof(role.coordinator.missing), "MAX_CHILDREN does not fit the children bitmaps");
+
+// single radio buffer shared by every process (TX) and input callback (RX),
+// with one spare byte so received frames are always NUL-terminated
+static char message[MESSAGE_SIZE + 1];
+static linkaddr_t source;
+
 static uint32_t window_start = 0;
+static uint32_t alarm_start = 0; // start of the alarm slot of the window, sent to the children in the polls
 static int window_size = WINDOW_SIZE;
 static int window_allotted = WINDOW_SIZE;
 
 static const linkaddr_t edge_node = BORDER_NODE;
 
 static bool waiting_for_clock = false;
-static bool waiting_for_window_start = false;
-static bool waiting_for_window_allotted = false;
+static uint8_t clock_round = 0; // synchronization round of the last clock request
+static int window_number = -1; // number of the last window frame received
 
 static int counter = 0;
-static int clock_offset = 0;
+static int32_t clock_offset = 0;
 
 /*---------------------------------------------------------------------------*/
 
@@ -64,92 +126,296 @@ uint32_t get_clock() {
     return (uint32_t) (clock_time() + clock_offset);
 }
 
-void send_data(){
+int16_t read_sensor() {
+    // the application has no real sensor, readings are a counter
+    return counter++;
+}
+
+void send_data(uint8_t window){
+    // a second poll in the same window means our reply was lost, send the same readings again
+    if (!role.sensor.sampled || window != role.sensor.window) {
+        for (int i = 0; i < DATA_LENGTH; i++) {
+            memcpy(&role.sensor.readings[i].sensor, &linkaddr_node_addr, sizeof(linkaddr_t));
+            role.sensor.readings[i].seq = role.sensor.seq++;
+            role.sensor.readings[i].value = read_sensor();
+            role.sensor.readings[i].sampled = get_clock();
+            role.sensor.readings[i].forwarded = 0;
+        }
+        role.sensor.window = window;
+        role.sensor.sampled = true;
+    }
     // send the counter to the coordinator
     for (int i = 0; i < DATA_LENGTH; i++) {
-        memcpy(nullnet_buf, &counter, sizeof(counter));
-        nullnet_len = sizeof(counter);
+        nullnet_len = frame_build(nullnet_buf, "data", &role.sensor.readings[i], sizeof(struct data_frame));
+        NETSTACK_NETWORK.output(&parent);
+    }
+    // send "done" to parent
+    struct poll_frame done = { window, DATA_LENGTH, 0, 0 };
+    nullnet_len = frame_build(nullnet_buf, "done", &done, sizeof(done));
+    NETSTACK_NETWORK.output(&parent);
+}
+
+void add_sample(int16_t value) {
+    // report-by-exception mode, add a sample to the aggregate of the current window
+    if (role.sensor.count == 0 || value < role.sensor.min) {
+        role.sensor.min = value;
+    }
+    if (role.sensor.count == 0 || value > role.sensor.max) {
+        role.sensor.max = value;
+    }
+    role.sensor.sum += value;
+    role.sensor.count++;
+    role.sensor.last_sample = get_clock();
+}
+
+void check_alarm(int16_t value) {
+    // raise an alarm when a sample reaches ALARM_THRESHOLD, once until it goes back under it;
+    // it waits for the alarm slot, a newer alarm replaces one still waiting
+    if (value < ALARM_THRESHOLD) {
+        role.sensor.alarm_raised = false;
+        return;
+    }
+    if (role.sensor.alarm_raised) {
+        return;
+    }
+    role.sensor.alarm_raised = true;
+    memcpy(&role.sensor.alarm.sensor, &linkaddr_node_addr, sizeof(linkaddr_t));
+    role.sensor.alarm.seq = role.sensor.alarm_seq++;
+    role.sensor.alarm.value = value;
+    role.sensor.alarm.sampled = get_clock();
+    role.sensor.alarm.forwarded = 0;
+    role.sensor.alarm_pending = true;
+    LOG_INFO("SENSOR | Alarm, sample %d\n", value);
+}
+
+int32_t alarm_delay() {
+    // ticks until a random time in the first half of the alarm slot (the second
+    // half leaves time to the coordinators to forward), -1 if the slot is over or unknown
+    if (!role.sensor.alarm_pending || !role.sensor.alarm_slot_known) {
+        return -1;
+    }
+    int32_t start = (int32_t) (role.sensor.alarm_slot - get_clock());
+    int32_t end = start + ALARM_SLOT / 2;
+    if (end <= 0) {
+        return -1; // wait for the slot of the next window, learnt from the next poll
+    }
+    if (start < 0) {
+        start = 0;
+    }
+    return start + random_rand() % (end - start);
+}
+
+void send_alarm() {
+    LOG_INFO("SENSOR | Sending alarm %d\n", role.sensor.alarm.seq);
+    for (int i = 0; i < ALARM_REPEAT; i++) {
+        nullnet_len = frame_build(nullnet_buf, "alarm", &role.sensor.alarm, sizeof(role.sensor.alarm));
+        NETSTACK_NETWORK.output(&parent);
+    }
+    role.sensor.alarm_pending = false;
+}
+
+void send_aggregate(uint8_t window){
+    // a second poll in the same window means our reply was lost, send the same reply again
+    if (!role.sensor.sampled || window != role.sensor.window) {
+        // report only when a sample moved away from the last reported mean
+        role.sensor.changed = role.sensor.count > 0 && (!role.sensor.reported
+            || role.sensor.max - role.sensor.reported_mean >= REPORT_THRESHOLD
+            || role.sensor.reported_mean - role.sensor.min >= REPORT_THRESHOLD);
+        if (role.sensor.changed) {
+            memcpy(&role.sensor.aggregate.sensor, &linkaddr_node_addr, sizeof(linkaddr_t));
+            role.sensor.aggregate.seq = role.sensor.seq++;
+            role.sensor.aggregate.min = role.sensor.min;
+            role.sensor.aggregate.max = role.sensor.max;
+            role.sensor.aggregate.mean = role.sensor.sum / role.sensor.count;
+            role.sensor.aggregate.count = role.sensor.count > 255 ? 255 : role.sensor.count;
+            role.sensor.aggregate.sampled = role.sensor.last_sample;
+            role.sensor.aggregate.forwarded = 0;
+            role.sensor.reported_mean = role.sensor.aggregate.mean;
+            role.sensor.reported = true;
+        }
+        // start the aggregate of the next window
+        role.sensor.sum = 0;
+        role.sensor.count = 0;
+        role.sensor.window = window;
+        role.sensor.sampled = true;
+    }
+    if (!role.sensor.changed) {
+        memcpy(nullnet_buf, UNCHANGED, 1);
+        nullnet_len = 1;
         NETSTACK_NETWORK.output(&parent);
-        counter++;
+        return;
     }
+    nullnet_len = frame_build(nullnet_buf, "agg", &role.sensor.aggregate, sizeof(role.sensor.aggregate));
+    NETSTACK_NETWORK.output(&parent);
     // send "done" to parent
-    memcpy(nullnet_buf, "done", sizeof("done"));
-    nullnet_len = sizeof("done");
+    struct poll_frame done = { window, 1, 0, 0 };
+    nullnet_len = frame_build(nullnet_buf, "done", &done, sizeof(done));
     NETSTACK_NETWORK.output(&parent);
 }
 
+int child_index(const linkaddr_t* child) {
+    // index of child in the children array, -1 if it is not our child
+    for (int i = 0; i < role.coordinator.children_size; i++) {
+        if (linkaddr_cmp(&role.coordinator.children[i], child)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 void new_child(const linkaddr_t* child) {
+    // a child whose "parent" reply was lost asks again, do not add it twice
+    if (child_index(child) >= 0 || role.coordinator.children_size >= MAX_CHILDREN) {
+        return;
+    }
     // increase the size of the children array
     LOG_INFO("Adding child %d.%d\n", child->u8[0], child->u8[1]);
-    memcpy(&children[children_size], child, sizeof(linkaddr_t));
-    children_size++;
+    memcpy(&role.coordinator.children[role.coordinator.children_size], child, sizeof(linkaddr_t));
+    role.coordinator.children_size++;
 }
 
-void input_callback_sensor(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest) {
-    static char message[20];
-    static linkaddr_t source;
+void send_unchanged() {
+    // tell the parent which children replied UNCHANGED, nothing is forwarded for them
+    linkaddr_t same[SAME_PER_FRAME];
+    int n = 0;
+    for (int i = 0; i < role.coordinator.children_size; i++) {
+        if (role.coordinator.unchanged & ((uint32_t) 1 << i)) {
+            memcpy(&same[n++], &role.coordinator.children[i], sizeof(linkaddr_t));
+        }
+        if (n > 0 && (n == SAME_PER_FRAME || i == role.coordinator.children_size - 1)) {
+            nullnet_len = frame_build(nullnet_buf, "same", same, n * sizeof(linkaddr_t));
+            NETSTACK_NETWORK.output(&parent);
+            n = 0;
+        }
+    }
+}
+
+void remove_child(int index) {
+    LOG_INFO("Removing child %d.%d\n", role.coordinator.children[index].u8[0], role.coordinator.children[index].u8[1]);
+    for (int k = index; k < role.coordinator.children_size - 1; k++) {
+        memcpy(&role.coordinator.children[k], &role.coordinator.children[k+1], sizeof(linkaddr_t));
+        role.coordinator.misses[k] = role.coordinator.misses[k+1];
+    }
+    role.coordinator.children_size--;
+}
+
+void remove_missing_children() {
+    // remove the children that missed too many windows in a row; a child the
+    // timeslot ended before polling has not missed this window
+    for (int i = role.coordinator.children_size - 1; i >= 0; i--) {
+        if (!(role.coordinator.polled & ((uint32_t) 1 << i))) {
+            continue;
+        }
+        if (!(role.coordinator.missing & ((uint32_t) 1 << i))) {
+            role.coordinator.misses[i] = 0;
+        } else if (++role.coordinator.misses[i] >= MAX_MISSES) {
+            remove_child(i);
+        }
+    }
+}
+
+void become_coordinator() {
+    // the candidate tables are dropped, their storage becomes the children table
+    if (type != 1) {
+        type = 1;
+        memset(&role, 0, sizeof(role));
+    }
+}
+
+void become_sensor() {
+    // the sensor state starts empty, not from the candidate tables it shares storage with
+    if (type != 0) {
+        type = 0;
+        memset(&role.sensor, 0, sizeof(role.sensor));
+    }
+}
+
+void receive(const void *data, uint16_t len, const linkaddr_t *src) {
+    // copy a received frame into the shared buffer
+    if (len > MESSAGE_SIZE) {
+        len = MESSAGE_SIZE;
+    }
+    memset(message, 0, sizeof(message));
+    memcpy(message, data, len);
     memcpy(&source, src, sizeof(linkaddr_t));
-    memcpy(&message, data, len);
+}
+
+void input_callback_sensor(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest) {
+    receive(data, len, src);
     LOG_INFO("SENSOR | Received %s from %d.%d to %d.%d\n", message, src->u8[0], src->u8[1], dest->u8[0], dest->u8[1]);
     if (strcmp(message, "poll") == 0) {
-        // set the last poll time
+        struct poll_frame poll;
+        if (!frame_payload(message, len, &poll, sizeof(poll))) {
+            return;
+        }
+        // set the last poll time, and our clock from the clock of the coordinator
         last_poll = clock_seconds();
-        send_data();
+        clock_offset = poll.clock - (uint32_t) clock_time();
+#if ALARM_THRESHOLD
+        // the alarm slot of this window, main_sensor schedules a waiting alarm in it
+        role.sensor.alarm_slot = poll.alarm;
+        role.sensor.alarm_slot_known = true;
+        if (role.sensor.alarm_pending) {
+            process_poll(&main_sensor);
+        }
+#endif
+#if REPORT_BY_EXCEPTION
+        send_aggregate(poll.window);
+#else
+        send_data(poll.window);
+#endif
         return;
     }
 }
 
 void input_callback_coordinator(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest) {
-    static char message[20];
-    static linkaddr_t source;
-    memcpy(&source, src, sizeof(linkaddr_t));
-    memcpy(&message, data, len);
+    receive(data, len, src);
     LOG_INFO("COORDINATOR | Received %s from %d.%d to %d.%d\n", message, src->u8[0], src->u8[1], dest->u8[0], dest->u8[1]);
     // if message comes from parent, call message_from_parent()
     if (linkaddr_cmp(&source, &parent)) {
-        // if the message is "clock" send back the clock
+        // if the message is "clock_request" send back the clock
         if (strcmp(message, "clock_request") == 0) {
-            // send back the clock
-            clock_time_t current_clock = get_clock();
-            memcpy(nullnet_buf, &current_clock, sizeof(current_clock));
-            nullnet_len = sizeof(current_clock);
+            struct clock_frame request;
+            if (!frame_payload(message, len, &request, sizeof(request))) {
+                return;
+            }
+            // send back the clock, tagged with the round of the request
+            struct clock_frame reply = { request.round, get_clock() };
+            nullnet_len = frame_build(nullnet_buf, "clock", &reply, sizeof(reply));
             NETSTACK_NETWORK.output(&parent);
+            clock_round = request.round;
             waiting_for_clock = true;
         }
-        // if the message is "window"
+        // if the message is "window", set the window start and the window allotted
         else if (strcmp(message, "window") == 0) {
-            waiting_for_window_start = true;
+            struct window_frame window;
+            if (!frame_payload(message, len, &window, sizeof(window)) || window.window == window_number) {
+                return; // malformed or repeated
+            }
+            window_number = window.window;
+            window_start = window.start;
+            window_allotted = window.allotted;
+            alarm_start = window.alarm;
+            process_poll(&main_coordinator);
         }
-        else if (waiting_for_clock) {
+        else if (strcmp(message, "clock") == 0 && waiting_for_clock) {
+            struct clock_frame clock;
+            if (!frame_payload(message, len, &clock, sizeof(clock)) || clock.round != clock_round) {
+                return;
+            }
             // set the clock offset equals to the difference between the clock received and the current clock
-            uint32_t temp = 0;
-            memcpy(&temp, message, sizeof(temp));
-            int new_clock_offset = (uint32_t) clock_time() - temp;
-            memcpy(&clock_offset, &new_clock_offset, sizeof(clock_offset));
-            LOG_INFO("New clock offset: %d, (%d, %d)\n", (int) clock_offset, (int) clock_time(), (int) temp);
+            clock_offset = clock.clock - (uint32_t) clock_time();
+            LOG_INFO("New clock offset: %d, (%d, %d)\n", (int) clock_offset, (int) clock_time(), (int) clock.clock);
             waiting_for_clock = false;
         }
         
-        else if (waiting_for_window_start) {
-            // set the window start
-            memcpy(&window_start, message, sizeof(window_start));
-            waiting_for_window_start = false;
-            waiting_for_window_allotted = true;
-        }
-        else if (waiting_for_window_allotted) {
-            // set the window allotted
-            memcpy(&window_allotted, message, sizeof(window_allotted));
-            waiting_for_window_allotted = false;
-            process_poll(&main_coordinator);
-        }
-        
         return;
     }
 
     // if message is new, send our type
     if (strcmp(message, "new") == 0) {
         // if there is space for new child, send "coordinator"
-        if (children_size < MAX_CHILDREN) {
+        if (role.coordinator.children_size < MAX_CHILDREN) {
             memcpy(nullnet_buf, "coordinator", sizeof("coordinator"));
             nullnet_len = sizeof("coordinator");
             NETSTACK_NETWORK.output(&source);
@@ -168,47 +434,70 @@ void input_callback_coordinator(const void *data, uint16_t len, const linkaddr_t
         return;
     }
     // if message is "done", wake up the process
-    else if (strcmp(message, "done") == 0 && linkaddr_cmp(&source, &current_child)) { // check if the message is from current child
-        // wake up the process
+    else if (strcmp(message, "done") == 0 && linkaddr_cmp(&source, &role.coordinator.current_child)) { // check if the message is from current child
+        struct poll_frame done;
+        // a late "done" answering an earlier window must not end the current poll
+        if (frame_payload(message, len, &done, sizeof(done)) && done.window == role.coordinator.window) {
+            role.coordinator.child_done = true;
+            // wake up the process
+            process_poll(&main_coordinator);
+        }
+        return;
+    }
+    // if message is "alarm", forward it to parent at once, whichever child is being polled
+    else if (strcmp(message, "alarm") == 0 && child_index(&source) >= 0) {
+        LOG_INFO("COORDINATOR | Forwarding alarm from %d.%d\n", src->u8[0], src->u8[1]);
+        nullnet_len = len < MESSAGE_SIZE ? len : MESSAGE_SIZE;
+        frame_stamp_forwarded(nullnet_buf, nullnet_len, get_clock());
+        NETSTACK_NETWORK.output(&parent);
+        return;
+    }
+    // if message is UNCHANGED, the child is done and there is nothing to forward
+    else if (strcmp(message, UNCHANGED) == 0 && linkaddr_cmp(&source, &role.coordinator.current_child)) {
+        role.coordinator.unchanged |= (uint32_t) 1 << child_index(&source);
+        role.coordinator.child_done = true;
         process_poll(&main_coordinator);
         return;
     }
-    else if (linkaddr_cmp(&source, &current_child)){ // check if the message is from current child
+    else if ((strcmp(message, "data") == 0 || strcmp(message, "agg") == 0) && child_index(&source) >= 0){ // late data from a previous poll is still forwarded
         // forward the message to parent (edge node)
+        // the frame is already in the radio buffer, send it as received
         LOG_INFO("COORDINATOR | Forwarding %s from %d.%d to %d.%d\n", message, src->u8[0], src->u8[1], dest->u8[0], dest->u8[1]);
-        memcpy(nullnet_buf, message, sizeof(message));
-        nullnet_len = sizeof(message);
+        nullnet_len = len < MESSAGE_SIZE ? len : MESSAGE_SIZE;
+        frame_stamp_forwarded(nullnet_buf, nullnet_len, get_clock());
         NETSTACK_NETWORK.output(&parent);
     }
     
 }
 
 void input_callback_setup(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest) {
-    static char message[20];
-    static linkaddr_t source;
-    memcpy(&source, src, sizeof(linkaddr_t));
-    memcpy(&message, data, len);
+    receive(data, len, src);
     LOG_INFO("SETUP | Received %s from %d.%d to %d.%d\n", message, src->u8[0], src->u8[1], dest->u8[0], dest->u8[1]);
     // if message is "coordinator", add src to coord_candidate
+    // (not once we are a coordinator, the tables then hold our children)
     if (strcmp(message, "coordinator") == 0) {
-        memcpy(&coord_candidate[coord_candidate_index], &source, sizeof(linkaddr_t));
-        coord_candidate_rssi[coord_candidate_index] = cc2420_last_rssi;
-        coord_candidate_index++;
+        if (type != 1 && role.setup.coord_candidate_index < MAX_CANDIDATE) {
+            memcpy(&role.setup.coord_candidate[role.setup.coord_candidate_index], &source, sizeof(linkaddr_t));
+            role.setup.coord_candidate_rssi[role.setup.coord_candidate_index] = cc2420_last_rssi;
+            role.setup.coord_candidate_index++;
+        }
         return;
         
     }
     // if message is "sensor", add src to sensor_candidate
     else if (strcmp(message, "sensor") == 0) {
-        memcpy(&sensor_candidate[sensor_candidate_index], &source, sizeof(linkaddr_t));
-        sensor_candidate_rssi[sensor_candidate_index] = cc2420_last_rssi;
-        sensor_candidate_index++;
+        if (type != 1 && role.setup.sensor_candidate_index < MAX_CANDIDATE) {
+            memcpy(&role.setup.sensor_candidate[role.setup.sensor_candidate_index], &source, sizeof(linkaddr_t));
+            role.setup.sensor_candidate_rssi[role.setup.sensor_candidate_index] = cc2420_last_rssi;
+            role.setup.sensor_candidate_index++;
+        }
         return;
     }
     // if message is "child", we are coordinator, add src to children
     else if (strcmp(message, "child") == 0) {
         // if we have no parent, set type as 1
         if (linkaddr_cmp(&parent, &linkaddr_null)) {
-            type = 1;
+            become_coordinator();
             // broadcast "coordinator" to all other nodes
             memcpy(nullnet_buf, "coordinator", sizeof("coordinator"));
             nullnet_len = sizeof("coordinator");
@@ -247,7 +536,7 @@ void input_callback_setup(const void *data, uint16_t len, const linkaddr_t *src,
         }
         else if (type == 1){
             // if there is space for new child, send "coordinator"
-            if (children_size < MAX_CHILDREN) {
+            if (role.coordinator.children_size < MAX_CHILDREN) {
                 memcpy(nullnet_buf, "coordinator", sizeof("coordinator"));
                 nullnet_len = sizeof("coordinator");
                 NETSTACK_NETWORK.output(&source);
@@ -260,7 +549,7 @@ void input_callback_setup(const void *data, uint16_t len, const linkaddr_t *src,
     
     // if message is "parent", set src as parent
     else if (strcmp(message, "parent") == 0) {
-        type = 0;
+        become_sensor();
         return;
     }
     // if message is "no", restart the process
@@ -274,7 +563,7 @@ void input_callback_setup(const void *data, uint16_t len, const linkaddr_t *src,
             process_start(&setup_process, NULL);
         } else {
             // if we have tried too many times, set type as 1
-            type = 1;
+            become_coordinator();
             memcpy(&parent, &edge_node, sizeof(linkaddr_t));
         }
         return;
@@ -283,22 +572,15 @@ void input_callback_setup(const void *data, uint16_t len, const linkaddr_t *src,
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(setup_process, ev, data) {
     static struct etimer periodic_timer;
-    static char message[20];
     PROCESS_BEGIN();
     LOG_INFO("Starting setup process\n");
     type = -1;
     /* Initialize NullNet */
     // empty all the arrays
-    memset(&coord_candidate, 0, sizeof(coord_candidate));
-    memset(&coord_candidate_rssi, 0, sizeof(coord_candidate_rssi));
-    memset(&sensor_candidate, 0, sizeof(sensor_candidate));
-    memset(&sensor_candidate_rssi, 0, sizeof(sensor_candidate_rssi));
-    children_size = 0;
-    coord_candidate_index = 0;
-    sensor_candidate_index = 0;
+    memset(&role, 0, sizeof(role));
 
     nullnet_buf = (uint8_t *)&message;
-    nullnet_len = sizeof(message);
+    nullnet_len = MESSAGE_SIZE;
     nullnet_set_input_callback(input_callback_setup);
 
     // broadcast "new" to all other nodes
@@ -310,42 +592,47 @@ PROCESS_THREAD(setup_process, ev, data) {
     etimer_set(&periodic_timer,GATHER_TIME * CLOCK_SECOND);
     PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&periodic_timer));
 
-    // if there is only one coordinator candidate, set it as parent
-    if (coord_candidate_index == 1) {
-        memcpy(&parent, &coord_candidate[0], sizeof(linkaddr_t));
-        type = 0;
-    }
-    // if there are multiple coordinator candidates, set the one with highest rssi as parent
-    else if (coord_candidate_index > 1) {
-        int max_rssi = -100;
-        int max_index = 0;
-        for (int i = 0; i < coord_candidate_index; i++) {
-            if (coord_candidate_rssi[i] > max_rssi) {
-                max_rssi = coord_candidate_rssi[i];
-                max_index = i;
+    // if a child adopted us while gathering, we are already a coordinator
+    if (type != 1) {
+        // if there is only one coordinator candidate, set it as parent
+        if (role.setup.coord_candidate_index == 1) {
+            memcpy(&parent, &role.setup.coord_candidate[0], sizeof(linkaddr_t));
+            become_sensor();
+        }
+        // if there are multiple coordinator candidates, set the one with highest rssi as parent
+        else if (role.setup.coord_candidate_index > 1) {
+            int max_rssi = -100;
+            int max_index = 0;
+            for (int i = 0; i < role.setup.coord_candidate_index; i++) {
+                if (role.setup.coord_candidate_rssi[i] > max_rssi) {
+                    max_rssi = role.setup.coord_candidate_rssi[i];
+                    max_index = i;
+                }
             }
+            memcpy(&parent, &role.setup.coord_candidate[max_index], sizeof(linkaddr_t));
+            become_sensor();
         }
-        type = 0;
-        memcpy(&parent, &coord_candidate[max_index], sizeof(linkaddr_t));
-    }
-    // if there is no coordinator candidate but there is sensor candidate, set the one with highest rssi as parent
-    else if (sensor_candidate_index > 0) {
-        int max_rssi = -100;
-        int max_index = 0;
-        for (int i = 0; i < sensor_candidate_index; i++) {
-            if (sensor_candidate_rssi[i] > max_rssi) {
-                max_rssi = sensor_candidate_rssi[i];
-                max_index = i;
+        // if there is no coordinator candidate but there is sensor candidate, set the one with highest rssi as parent
+        else if (role.setup.sensor_candidate_index > 0) {
+            int max_rssi = -100;
+            int max_index = 0;
+            for (int i = 0; i < role.setup.sensor_candidate_index; i++) {
+                if (role.setup.sensor_candidate_rssi[i] > max_rssi) {
+                    max_rssi = role.setup.sensor_candidate_rssi[i];
+                    max_index = i;
+                }
             }
+            memcpy(&parent, &role.setup.sensor_candidate[max_index], sizeof(linkaddr_t));
+            become_sensor();
+        }
+        // if there is no coordinator candidate, we are the coordinator
+        else {
+            become_coordinator();
         }
-        type = 0;
-        memcpy(&parent, &sensor_candidate[max_index], sizeof(linkaddr_t));
     }
-    // if there is no coordinator candidate, set the edge node as parent
-    else {
-        // we are the coordinator
+    // if we are the coordinator, set the edge node as parent
+    if (type == 1) {
         memcpy(&parent, &edge_node, sizeof(linkaddr_t));
-        type = 1;
         // send "coordinator" to the edge node
         memcpy(nullnet_buf, "coordinator", sizeof("coordinator"));
         nullnet_len = sizeof("coordinator");
@@ -365,16 +652,17 @@ PROCESS_THREAD(setup_process, ev, data) {
 PROCESS_THREAD(main_coordinator, ev, data) {
     PROCESS_BEGIN();
     static struct etimer window_timer;
-    static char message[20];
 
     LOG_INFO("COORDINATOR | Parent: %d.%d\n", parent.u8[0], parent.u8[1]);
 
     /* Initialize NullNet */
     nullnet_buf = (uint8_t *)&message;
-    nullnet_len = sizeof(message);
+    nullnet_len = MESSAGE_SIZE;
     nullnet_set_input_callback(input_callback_coordinator);
 
+    static struct etimer poll_timer;
     static int i;
+    static int pass;
     PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
 
     while (1){
@@ -382,7 +670,7 @@ PROCESS_THREAD(main_coordinator, ev, data) {
             // wait until the window starts
         }
         // if we have no children, send "ping" to parent
-        if (children_size == 0) {
+        if (role.coordinator.children_size == 0) {
             LOG_INFO("COORDINATOR | No child, sending ping to parent\n");
             memcpy(nullnet_buf, "ping", sizeof("ping"));
             nullnet_len = sizeof("ping");
@@ -390,45 +678,46 @@ PROCESS_THREAD(main_coordinator, ev, data) {
         }
         
         etimer_set(&window_timer, window_allotted);
-        i=0;
-        while(!etimer_expired(&window_timer)) {
-            if (i < children_size){
-                // send "sensor" to parent
-                memcpy(nullnet_buf, "sensor", sizeof("sensor"));
-                nullnet_len = sizeof("sensor");
-                NETSTACK_NETWORK.output(&parent);
-
-                // send the child address to the parent
-                memcpy(nullnet_buf, &children[i], sizeof(linkaddr_t));
-                nullnet_len = sizeof(linkaddr_t);
-                NETSTACK_NETWORK.output(&parent);
-
+        role.coordinator.window++;
+        role.coordinator.polled = 0;
+        role.coordinator.missing = 0;
+        role.coordinator.unchanged = 0;
+        for (i = 0; i < role.coordinator.children_size; i++) {
+            role.coordinator.missing |= (uint32_t) 1 << i;
+        }
+        // the first pass polls every child, the next ones re-poll only the children
+        // whose reply was lost, in the time left in our timeslot
+        for (pass = 0; pass < MAX_POLLS && role.coordinator.missing != 0; pass++) {
+            for (i = 0; i < role.coordinator.children_size && !etimer_expired(&window_timer); i++) {
+                if (!(role.coordinator.missing & ((uint32_t) 1 << i))) {
+                    continue;
+                }
                 // send the poll to the child
-                memcpy(nullnet_buf, "poll", sizeof("poll"));
-                nullnet_len = sizeof("poll");
-                memcpy(&current_child, &children[i], sizeof(linkaddr_t));
-                LOG_INFO("Sending poll to %d.%d\n", current_child.u8[0], current_child.u8[1]);
-                NETSTACK_NETWORK.output(&current_child);
-
-                // wait until the window timer expires or we receive a "done" from the child
-                PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&window_timer) || ev == PROCESS_EVENT_POLL);
-                if (etimer_expired(&window_timer)) {
+                struct poll_frame poll = { role.coordinator.window, 0, get_clock(), alarm_start };
+                nullnet_len = frame_build(nullnet_buf, "poll", &poll, sizeof(poll));
+                memcpy(&role.coordinator.current_child, &role.coordinator.children[i], sizeof(linkaddr_t));
+                role.coordinator.child_done = false;
+                role.coordinator.polled |= (uint32_t) 1 << i;
+                LOG_INFO("Sending poll to %d.%d\n", role.coordinator.current_child.u8[0], role.coordinator.current_child.u8[1]);
+                NETSTACK_NETWORK.output(&role.coordinator.current_child);
+
+                // wait until we receive a "done" from the child or one of the timers expires
+                etimer_set(&poll_timer, POLL_TIMEOUT);
+                PROCESS_WAIT_EVENT_UNTIL(role.coordinator.child_done || etimer_expired(&poll_timer) || etimer_expired(&window_timer));
+                if (role.coordinator.child_done) {
+                    role.coordinator.missing &= ~((uint32_t) 1 << i);
+                } else {
                     LOG_INFO("Sensor %d timeout\n", i);
-                    // remove the child from the children list
-                    for (int j = 0; j < children_size; j++) {
-                        if (linkaddr_cmp(&children[j], &current_child)) {
-                            for (int k = j; k < children_size - 1; k++) {
-                                memcpy(&children[k], &children[k+1], sizeof(linkaddr_t));
-                            }
-                            children_size--;
-                            break;
-                        }
-                    }   
                 }
-                i++;
-            } else {
-                PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&window_timer)); // wait until the window timer expires if we have no more children
             }
+            if (etimer_expired(&window_timer)) {
+                break;
+            }
+        }
+        send_unchanged();
+        remove_missing_children();
+        if (!etimer_expired(&window_timer)) {
+            PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&window_timer)); // wait until the window timer expires
         }
 
         // sleep for window_size - window_alloted ticks
@@ -443,17 +732,61 @@ PROCESS_THREAD(main_coordinator, ev, data) {
 PROCESS_THREAD(main_sensor, ev, data) {
     PROCESS_BEGIN();
     static struct etimer periodic_timer;
-    static char message[20];
+#if REPORT_BY_EXCEPTION || ALARM_THRESHOLD
+    static struct etimer sample_timer;
+    static int16_t sample;
+#endif
+#if ALARM_THRESHOLD
+    static struct etimer alarm_timer;
+    static bool alarm_scheduled;
+    static int32_t delay;
+#endif
     LOG_INFO("SENSOR | Parent: %d.%d\n", parent.u8[0], parent.u8[1]);
 
     /* Initialize NullNet */
     nullnet_buf = (uint8_t *)&message;
-    nullnet_len = sizeof(message);
+    nullnet_len = MESSAGE_SIZE;
     nullnet_set_input_callback(input_callback_sensor);
     while (1){
         // sleep for MAX_WAIT seconds (all sensor processing is done in the input_callback_sensor function)
         etimer_set(&periodic_timer, MAX_WAIT * CLOCK_SECOND);
+#if REPORT_BY_EXCEPTION || ALARM_THRESHOLD
+        // meanwhile, take a sample every SAMPLE_PERIOD ticks for the alarms and the aggregate of the window
+        etimer_set(&sample_timer, SAMPLE_PERIOD);
+        while (!etimer_expired(&periodic_timer)) {
+            // a poll event means a new alarm slot is known
+            PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&sample_timer) || etimer_expired(&periodic_timer)
+                                     || ev == PROCESS_EVENT_EXIT || ev == PROCESS_EVENT_POLL || ev == PROCESS_EVENT_TIMER);
+            if ( ev == PROCESS_EVENT_EXIT ) {
+                break;
+            }
+            if (etimer_expired(&sample_timer)) {
+                sample = read_sensor();
+#if ALARM_THRESHOLD
+                check_alarm(sample);
+#endif
+#if REPORT_BY_EXCEPTION
+                add_sample(sample);
+#endif
+                etimer_reset(&sample_timer);
+            }
+#if ALARM_THRESHOLD
+            // alarms contend only in the alarm slot, at a random time to spread the sensors
+            if (alarm_scheduled && etimer_expired(&alarm_timer)) {
+                alarm_scheduled = false;
+                if (role.sensor.alarm_pending) {
+                    send_alarm();
+                }
+            }
+            if (!alarm_scheduled && (delay = alarm_delay()) >= 0) {
+                etimer_set(&alarm_timer, delay);
+                alarm_scheduled = true;
+            }
+#endif
+        }
+#else
         PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&periodic_timer) || ev == PROCESS_EVENT_EXIT);
+#endif
         if ( ev == PROCESS_EVENT_EXIT ) {
             LOG_INFO("Exiting main_sensor\n");
             break;
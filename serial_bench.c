@@ -0,0 +1,261 @@
+/**
+ * \file
+ *         UART throughput and latency benchmark, driven by serial_bench.py
+ *
+ *         BENCH_MODE selects how the uart input is read:
+ *         - BENCH_LINE (default): lines through serial_line, every line
+ *           "<seq> <length> <payload>" is answered with "E <seq> <received length>",
+ *           "tx <count> <size>" sends count lines of size bytes,
+ *           "stats" answers "S <lines> <bytes> <dropped bytes>" and "reset" clears them
+ *         - BENCH_RAW: every byte received is echoed back; the echo is the
+ *           only channel, serial_bench.py counts the lost bytes itself
+ *         - BENCH_SLIP: every SLIP frame received is echoed back as a SLIP frame,
+ *           except the control frames "S", answered with the frame
+ *           "S <frames> <bytes> <dropped bytes>", and "R", which clears them
+ *           and is answered with "R"
+ *         Raw and SLIP modes read the uart directly; on the native target
+ *         every mode reads stdin and writes stdout, raw and SLIP modes with
+ *         the stdin reader of the platform turned off (see Makefile).
+ */
+
+#include "contiki.h"
+#include "dev/serial-line.h"
+#include "lib/ringbuf.h"
+#ifndef CONTIKI_TARGET_NATIVE
+#include "cpu/msp430/dev/uart0.h"
+#endif
+
+#include <stdio.h> /* For printf() */
+#include <stdlib.h>
+#include <string.h>
+#ifdef CONTIKI_TARGET_NATIVE
+#include <unistd.h>
+#endif
+
+#define BENCH_LINE 0
+#define BENCH_RAW 1
+#define BENCH_SLIP 2
+
+#ifndef BENCH_MODE
+#define BENCH_MODE BENCH_LINE
+#endif
+
+#ifndef SERIAL_LINE_CONF_BUFSIZE
+#define SERIAL_LINE_CONF_BUFSIZE 128 // serial_line default
+#endif
+#define RX_BUFFER_SIZE 128 // bytes buffered between the uart interrupt and the process (power of two)
+#define MAX_FRAME 128 // largest SLIP frame echoed back
+
+#define SLIP_END 0300
+#define SLIP_ESC 0333
+#define SLIP_ESC_END 0334
+#define SLIP_ESC_ESC 0335
+
+/*---------------------------------------------------------------------------*/
+PROCESS(serial_bench, "Serial benchmark process");
+AUTOSTART_PROCESSES(&serial_bench);
+/*---------------------------------------------------------------------------*/
+#if BENCH_MODE != BENCH_RAW
+static unsigned long lines = 0; // lines or frames received
+static unsigned long bytes = 0; // payload bytes received
+static unsigned long dropped = 0; // bytes announced or sent but not received
+#endif
+
+#if BENCH_MODE != BENCH_LINE
+static struct ringbuf rx_buf;
+static uint8_t rx_data[RX_BUFFER_SIZE];
+
+static int raw_input(unsigned char c) {
+    // called from the uart interrupt, the process does the echo
+    if (ringbuf_put(&rx_buf, c) == 0) {
+#if BENCH_MODE == BENCH_SLIP
+        dropped++;
+#endif
+    }
+    process_poll(&serial_bench);
+    return 1;
+}
+
+#ifdef CONTIKI_TARGET_NATIVE
+// stdin and stdout stand in for the uart
+static int stdin_set_fd(fd_set *rset, fd_set *wset) {
+    FD_SET(STDIN_FILENO, rset);
+    return 1;
+}
+
+static void stdin_handle_fd(fd_set *rset, fd_set *wset) {
+    uint8_t buf[RX_BUFFER_SIZE];
+    int free = ringbuf_size(&rx_buf) - 1 - ringbuf_elements(&rx_buf); // a ringbuf holds size - 1 bytes
+    if (!FD_ISSET(STDIN_FILENO, rset) || free == 0) {
+        return; // left in the pty until the process drained the ring buffer
+    }
+    int n = read(STDIN_FILENO, buf, free);
+    if (n == 0) {
+        exit(0); // serial_bench.py closed the pty
+    }
+    for (int i = 0; i < n; i++) {
+        raw_input(buf[i]);
+    }
+}
+
+static const struct select_callback stdin_callback = { stdin_set_fd, stdin_handle_fd };
+
+#define uart_writeb(c) putchar(c)
+#define uart_flush() fflush(stdout)
+#else
+#define uart_writeb(c) uart0_writeb(c)
+#define uart_flush()
+#endif
+#endif
+
+#if BENCH_MODE == BENCH_SLIP
+static uint8_t frame[MAX_FRAME];
+static int frame_len = 0;
+static bool escaped = false;
+
+static void slip_writeb(uint8_t c) {
+    if (c == SLIP_END) {
+        uart_writeb(SLIP_ESC);
+        c = SLIP_ESC_END;
+    } else if (c == SLIP_ESC) {
+        uart_writeb(SLIP_ESC);
+        c = SLIP_ESC_ESC;
+    }
+    uart_writeb(c);
+}
+
+static void slip_write(const uint8_t *data, int len) {
+    uart_writeb(SLIP_END);
+    for (int i = 0; i < len; i++) {
+        slip_writeb(data[i]);
+    }
+    uart_writeb(SLIP_END);
+}
+
+static void slip_frame() {
+    // a complete frame: a control frame or a frame to echo
+    static char stats[40];
+    if (frame_len == 1 && frame[0] == 'S') {
+        slip_write((uint8_t *) stats, snprintf(stats, sizeof(stats), "S %lu %lu %lu", lines, bytes, dropped));
+    } else if (frame_len == 1 && frame[0] == 'R') {
+        lines = bytes = dropped = 0;
+        slip_write(frame, frame_len);
+    } else {
+        slip_write(frame, frame_len);
+        lines++;
+        bytes += frame_len;
+    }
+}
+
+static void slip_input(uint8_t c) {
+    // decode one byte, answer the frame when it is complete
+    if (c == SLIP_END) {
+        if (frame_len > 0) {
+            slip_frame();
+        }
+        frame_len = 0;
+        escaped = false;
+        return;
+    }
+    if (escaped) {
+        c = c == SLIP_ESC_END ? SLIP_END : c == SLIP_ESC_ESC ? SLIP_ESC : c;
+        escaped = false;
+    } else if (c == SLIP_ESC) {
+        escaped = true;
+        return;
+    }
+    if (frame_len < MAX_FRAME) {
+        frame[frame_len++] = c;
+    } else {
+        dropped++;
+    }
+}
+#endif
+
+#if BENCH_MODE == BENCH_LINE
+static void line_input(char *line) {
+    static char buf[SERIAL_LINE_CONF_BUFSIZE];
+    unsigned long seq, length, count, size;
+
+    if (strcmp(line, "stats") == 0) {
+        printf("S %lu %lu %lu\n", lines, bytes, dropped);
+    } else if (strcmp(line, "reset") == 0) {
+        lines = bytes = dropped = 0;
+        printf("R\n");
+    } else if (sscanf(line, "tx %lu %lu", &count, &size) == 2) {
+        // send count lines of size bytes, newline included
+        if (size < 2) {
+            size = 2;
+        }
+        if (size > sizeof(buf)) {
+            size = sizeof(buf);
+        }
+        memset(buf, 'x', size - 1);
+        buf[size - 1] = '\0';
+        for (unsigned long i = 0; i < count; i++) {
+            printf("%s\n", buf);
+        }
+        printf("D %lu\n", count);
+    } else if (sscanf(line, "%lu %lu", &seq, &length) == 2) {
+        // the payload follows the second space, serial_line truncates lines that do not fit its buffer;
+        // sscanf() also accepts tabs between the numbers, the payload then counts as dropped
+        char *payload = strchr(line, ' ');
+        if (payload != NULL) {
+            payload = strchr(payload + 1, ' ');
+        }
+        unsigned long received = payload == NULL ? 0 : strlen(payload + 1);
+        lines++;
+        bytes += received;
+        if (received < length) {
+            dropped += length - received;
+        }
+        printf("E %lu %lu\n", seq, received);
+    }
+}
+#endif
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(serial_bench, ev, data)
+{
+  PROCESS_BEGIN();
+#if defined(SERIAL_BENCH_BAUD) && !defined(CONTIKI_TARGET_NATIVE)
+  uart0_init(BAUD2UBR(SERIAL_BENCH_BAUD));
+#endif
+#if BENCH_MODE == BENCH_LINE
+  serial_line_init();
+#ifndef CONTIKI_TARGET_NATIVE
+  uart0_set_input(serial_line_input_byte);
+#endif
+#else
+  ringbuf_init(&rx_buf, rx_data, sizeof(rx_data));
+#ifdef CONTIKI_TARGET_NATIVE
+  select_set_callback(STDIN_FILENO, &stdin_callback);
+#else
+  uart0_set_input(raw_input);
+#endif
+#endif
+
+  printf("Starting serial benchmark, mode %d\n", BENCH_MODE);
+  while(1) {
+    PROCESS_YIELD();
+#if BENCH_MODE == BENCH_LINE
+    if(ev == serial_line_event_message) {
+      line_input((char *) data);
+    }
+#else
+    if(ev == PROCESS_EVENT_POLL) {
+      int c;
+      while((c = ringbuf_get(&rx_buf)) != -1) {
+#if BENCH_MODE == BENCH_SLIP
+        slip_input(c);
+#else
+        uart_writeb(c);
+#endif
+      }
+      uart_flush();
+    }
+#endif
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
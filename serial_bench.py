@@ -0,0 +1,362 @@
+import argparse
+import os
+import pty
+import select
+import socket
+import statistics
+import subprocess
+import sys
+import termios
+import time
+import tty
+
+# Host side of serial_bench.c: measures UART throughput, round-trip latency
+# and dropped bytes for the line, raw and SLIP modes of the firmware.
+#
+#   python3 serial_bench.py --native ./serial_bench.native     (pty)
+#   python3 serial_bench.py --device /dev/ttyUSB0 --baud 115200 --mode slip
+#   python3 serial_bench.py --ip 127.0.0.1 --port 60001       (Cooja serial socket)
+#
+# The firmware runs at a single baud rate (SERIAL_BENCH_BAUD), rebuild it and
+# rerun the script for every baud rate to compare.
+
+SLIP_END = 0o300
+SLIP_ESC = 0o333
+SLIP_ESC_END = 0o334
+SLIP_ESC_ESC = 0o335
+
+
+class Link:
+    def __init__(self, fd, keep=None):
+        self.fd = fd
+        self.keep = keep  # socket or child process owning the other end
+        self.buf = b""
+
+    def write(self, data):
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+
+    def fill(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if not ready:
+            return False
+        data = os.read(self.fd, 4096)
+        if not data:
+            raise EOFError("link closed")
+        self.buf += data
+        return True
+
+    def read_line(self, timeout):
+        deadline = time.monotonic() + timeout
+        while b"\n" not in self.buf:
+            if not self.fill(max(0, deadline - time.monotonic())):
+                return None
+        line, self.buf = self.buf.split(b"\n", 1)
+        return line.rstrip(b"\r").decode("utf-8", "replace")
+
+    def read_available(self, timeout):
+        self.fill(timeout)
+        data, self.buf = self.buf, b""
+        return data
+
+    def close(self):
+        if isinstance(self.keep, subprocess.Popen):
+            self.keep.kill()
+            self.keep.wait()
+        elif self.keep is not None:
+            self.keep.close()
+        else:
+            os.close(self.fd)
+
+
+def open_native(binary):
+    master, slave = pty.openpty()
+    tty.setraw(slave)
+    proc = subprocess.Popen([binary], stdin=slave, stdout=slave, stderr=subprocess.DEVNULL)
+    os.close(slave)
+    return Link(master, proc)
+
+
+def open_device(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    speed = getattr(termios, "B%d" % baud)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return Link(fd)
+
+
+def open_socket(ip, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect((ip, port))
+    return Link(sock.fileno(), sock)
+
+
+def percentiles(samples):
+    if not samples:
+        return "p50=- p99=- max=-"
+    ordered = sorted(samples)
+    p99 = ordered[min(len(ordered) - 1, int(len(ordered) * 0.99))]
+    return "p50=%.2fms p99=%.2fms max=%.2fms" % (statistics.median(ordered) * 1000, p99 * 1000, ordered[-1] * 1000)
+
+
+def report(mode, test, size, text):
+    print("%-4s %-15s size=%-4d %s" % (mode, test, size, text))
+    sys.stdout.flush()
+
+
+# line mode ------------------------------------------------------------------
+
+def wait_for(link, prefix, timeout):
+    # skip the log lines of the firmware until the expected answer
+    deadline = time.monotonic() + timeout
+    while True:
+        line = link.read_line(max(0, deadline - time.monotonic()))
+        if line is None or line.startswith(prefix):
+            return line
+
+
+def line_reset(link, timeout):
+    link.write(b"reset\n")
+    if wait_for(link, "R", timeout) is None:
+        raise TimeoutError("no answer to reset, is the firmware in line mode?")
+
+
+def line_frame(seq, size):
+    return ("%d %d %s\n" % (seq, size, "x" * size)).encode()
+
+
+def line_latency(link, size, count, timeout):
+    line_reset(link, timeout)
+    rtts = []
+    dropped = 0
+    lost = 0
+    for seq in range(count):
+        start = time.monotonic()
+        link.write(line_frame(seq, size))
+        line = wait_for(link, "E %d " % seq, timeout)
+        if line is None:
+            lost += 1
+            continue
+        rtts.append(time.monotonic() - start)
+        dropped += size - int(line.split()[2])
+    report("line", "latency", size, "%s dropped=%dB lost=%d/%d" % (percentiles(rtts), dropped, lost, count))
+
+
+def line_rx(link, size, count, timeout):
+    line_reset(link, timeout)
+    frames = [line_frame(seq, size) for seq in range(count)]
+    start = time.monotonic()
+    link.write(b"".join(frames))
+    echoes = 0
+    dropped = 0
+    last = start
+    while echoes < count:
+        line = wait_for(link, "E ", timeout)
+        if line is None:
+            break
+        last = time.monotonic()
+        echoes += 1
+        dropped += size - int(line.split()[2])
+    sent = sum(len(frame) for frame in frames)
+    rate = sent / (last - start) if last > start else 0
+    report("line", "rx throughput", size, "%.0fB/s dropped=%dB lost=%d/%d" % (rate, dropped, count - echoes, count))
+
+
+def line_tx(link, size, count, timeout):
+    line_reset(link, timeout)
+    start = time.monotonic()
+    link.write(("tx %d %d\n" % (count, size)).encode())
+    received = 0
+    while True:
+        line = link.read_line(timeout)
+        if line is None or line.startswith("D "):
+            break
+        if set(line) == {"x"}:
+            received += len(line) + 1
+    elapsed = time.monotonic() - start
+    rate = received / elapsed if elapsed > 0 else 0
+    report("line", "tx throughput", size, "%.0fB/s dropped=%dB" % (rate, size * count - received))
+
+
+# raw mode -------------------------------------------------------------------
+
+def raw_exchange(link, chunks, timeout):
+    # write the chunks while reading the echo, so neither side blocks on a full buffer
+    expected = b"".join(chunks)
+    received = b""
+    start = time.monotonic()
+    last = start
+    for chunk in chunks:
+        link.write(chunk)
+        data = link.read_available(0)
+        if data:
+            received += data
+            last = time.monotonic()
+    while len(received) < len(expected):
+        data = link.read_available(timeout)
+        if not data:
+            break
+        received += data
+        last = time.monotonic()
+    return expected, received, last - start
+
+
+def raw_latency(link, size, count, timeout):
+    rtts = []
+    dropped = 0
+    for _ in range(count):
+        chunk = os.urandom(size)
+        expected, received, elapsed = raw_exchange(link, [chunk], timeout)
+        dropped += len(expected) - len(received)
+        if received == expected:
+            rtts.append(elapsed)
+    report("raw", "latency", size, "%s dropped=%dB" % (percentiles(rtts), dropped))
+
+
+def raw_rx(link, size, count, timeout):
+    expected, received, elapsed = raw_exchange(link, [os.urandom(size) for _ in range(count)], timeout)
+    corrupted = sum(1 for a, b in zip(expected, received) if a != b)
+    rate = len(received) / elapsed if elapsed > 0 else 0
+    report("raw", "echo throughput", size, "%.0fB/s dropped=%dB corrupted=%dB" % (rate, len(expected) - len(received), corrupted))
+
+
+# SLIP mode ------------------------------------------------------------------
+
+def slip_encode(frame):
+    out = bytearray([SLIP_END])
+    for c in frame:
+        if c == SLIP_END:
+            out += bytes([SLIP_ESC, SLIP_ESC_END])
+        elif c == SLIP_ESC:
+            out += bytes([SLIP_ESC, SLIP_ESC_ESC])
+        else:
+            out.append(c)
+    out.append(SLIP_END)
+    return bytes(out)
+
+
+def slip_decode(data):
+    frames = []
+    frame = bytearray()
+    escaped = False
+    for c in data:
+        if c == SLIP_END:
+            if frame:
+                frames.append(bytes(frame))
+            frame = bytearray()
+        elif escaped:
+            frame.append(SLIP_END if c == SLIP_ESC_END else SLIP_ESC if c == SLIP_ESC_ESC else c)
+            escaped = False
+        elif c == SLIP_ESC:
+            escaped = True
+        else:
+            frame.append(c)
+    return frames
+
+
+def slip_payload(size):
+    # random frame to echo, never one of the control frames "S" and "R"
+    while True:
+        frame = os.urandom(size)
+        if frame not in (b"S", b"R"):
+            return frame
+
+
+def slip_command(link, command, timeout):
+    # answer of the firmware to a control frame, the echoes still in flight are skipped
+    link.write(slip_encode(command))
+    received = b""
+    while True:
+        data = link.read_available(timeout)
+        if not data:
+            raise TimeoutError("no answer to %r, is the firmware in SLIP mode?" % command)
+        received += data
+        for frame in slip_decode(received):
+            if frame == command or frame.startswith(command + b" "):
+                return frame.decode("ascii", "replace")
+
+
+def slip_exchange(link, frames, timeout):
+    expected = b"".join(slip_encode(frame) for frame in frames)
+    _, received, elapsed = raw_exchange(link, [slip_encode(frame) for frame in frames], timeout)
+    # the echo can be shorter than what was sent, wait for the frames rather than the bytes
+    while len(slip_decode(received)) < len(frames):
+        data = link.read_available(timeout)
+        if not data:
+            break
+        received += data
+    return slip_decode(received), elapsed, len(expected)
+
+
+def slip_latency(link, size, count, timeout):
+    rtts = []
+    lost = 0
+    for _ in range(count):
+        frame = slip_payload(size)
+        echoed, elapsed, _ = slip_exchange(link, [frame], timeout)
+        if echoed == [frame]:
+            rtts.append(elapsed)
+        else:
+            lost += 1
+    report("slip", "latency", size, "%s lost=%d/%d" % (percentiles(rtts), lost, count))
+
+
+def slip_rx(link, size, count, timeout):
+    slip_command(link, b"R", timeout)
+    frames = [slip_payload(size) for _ in range(count)]
+    echoed, elapsed, encoded = slip_exchange(link, frames, timeout)
+    good = sum(1 for frame in echoed if frame in frames)
+    dropped = sum(len(frame) for frame in frames) - sum(len(frame) for frame in echoed)
+    rate = encoded / elapsed if elapsed > 0 else 0
+    # bytes the firmware dropped itself: ring buffer overflows and frames over MAX_FRAME
+    _, _, _, overflow = slip_command(link, b"S", timeout).split()
+    report("slip", "echo throughput", size, "%.0fB/s dropped=%dB (firmware %sB) lost=%d/%d"
+           % (rate, dropped, overflow, count - good, count))
+
+
+TESTS = {
+    "line": [line_latency, line_rx, line_tx],
+    "raw": [raw_latency, raw_rx],
+    "slip": [slip_latency, slip_rx],
+}
+
+
+def main(args):
+    if args.native:
+        link = open_native(args.native)
+    elif args.device:
+        link = open_device(args.device, args.baud)
+    else:
+        link = open_socket(args.ip, args.port)
+    try:
+        if args.mode == "line":
+            # wait for the banner of the firmware
+            wait_for(link, "Starting serial benchmark", args.timeout)
+        else:
+            time.sleep(args.timeout)
+            link.read_available(0)
+        for size in args.sizes:
+            for test in TESTS[args.mode]:
+                test(link, size, args.count, args.timeout)
+    finally:
+        link.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--native", dest="native", type=str, help="serial_bench.native binary, run on a pty")
+    parser.add_argument("--device", dest="device", type=str, help="serial device of the mote")
+    parser.add_argument("--baud", dest="baud", type=int, default=115200)
+    parser.add_argument("--ip", dest="ip", type=str)
+    parser.add_argument("--port", dest="port", type=int)
+    parser.add_argument("--mode", dest="mode", choices=sorted(TESTS), default="line", help="BENCH_MODE of the firmware")
+    parser.add_argument("--sizes", dest="sizes", type=lambda s: [int(x) for x in s.split(",")], default=[8, 32, 64, 100])
+    parser.add_argument("--count", dest="count", type=int, default=100)
+    parser.add_argument("--timeout", dest="timeout", type=float, default=1.0)
+    args = parser.parse_args()
+    if not (args.native or args.device or (args.ip and args.port)):
+        parser.error("one of --native, --device or --ip/--port is required")
+    main(args)
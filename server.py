@@ -3,6 +3,8 @@ import argparse
 import sys
 import time
 
+from store import Store, valid_address
+
 def recv(sock):
     data = sock.recv(1)
     buf = b""
@@ -16,6 +18,35 @@ def print_data():
     while True:
         data = recv(sock)
         print(data.decode("utf-8"))
+def parse_record(line):
+    # border records look like "DATA <sensor address> <value> ...", see latency.py for the other fields;
+    # logs share the uart, so a corrupted or interleaved record is printed and skipped like them
+    fields = line.split()
+    if len(fields) < 3 or fields[0] != "DATA" or not valid_address(fields[1]):
+        return None
+    try:
+        return fields[1], int(fields[2])
+    except ValueError:
+        return None
+def ingest(ip, port, path):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect((ip, port))
+    store = Store(path)
+    try:
+        while True:
+            line = recv(sock).decode("utf-8", "replace")
+            record = parse_record(line)
+            if record is None:
+                print(line)
+                continue
+            address, value = record
+            try:
+                store.append(address, int(time.time() * 1000), value)
+            except ValueError as e:
+                print("dropped %s: %s" % (line, e))
+            store.flush()
+    finally:
+        store.close()
 def main(ip, port):
     sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     sock.connect((ip, port))
@@ -29,4 +60,7 @@ if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("--ip", dest="ip", type=str)
     parser.add_argument("--port", dest="port", type=int)
+    parser.add_argument("--store", dest="store", type=str, help="directory of the time-series store")
     args = parser.parse_args()
+    if args.store:
+        ingest(args.ip, args.port, args.store)
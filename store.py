@@ -0,0 +1,228 @@
+import bisect
+import collections
+import mmap
+import os
+import re
+import struct
+
+# Columnar time-series store for the readings uplinked by the border node.
+#
+# Every sensor gets its own directory holding append-only column files:
+#   ts.col      int64 timestamps in milliseconds, non-decreasing
+#   val.col     int32 values, one per timestamp
+#   window.idx  (window id, first row) for every INDEX_WINDOW_MS window
+#   minute.col  per-minute rollups (minute, min, max, sum, count)
+# Reads go through memory maps of the column files, so range scans are a
+# bisect over the timestamp column instead of a reparse of text logs.
+# An open series holds up to 8 descriptors (4 files, 4 maps each with a dup
+# of its file), so only the MAX_OPEN_SERIES most recently used stay open.
+
+INDEX_WINDOW_MS = 3600 * 1000  # one index entry per hour of data
+MINUTE_MS = 60 * 1000
+MAX_OPEN_SERIES = 64
+ADDRESS = re.compile(r"[0-9]+\.[0-9]+")  # sensor address, also its directory name
+
+TS = struct.Struct("<q")
+VAL = struct.Struct("<i")
+IDX = struct.Struct("<qq")
+ROLLUP = struct.Struct("<qiiqi")
+
+
+class Column:
+    # append-only file with a read-only memory map over it
+    def __init__(self, path, fmt):
+        self.path = path
+        self.fmt = fmt
+        open(path, "ab").close()
+        self.file = open(path, "r+b")
+        self.count = os.fstat(self.file.fileno()).st_size // fmt.size
+        self.map = None
+        self.mapped = 0
+
+    def __len__(self):
+        return self.count
+
+    def append(self, *values):
+        self.file.seek(self.count * self.fmt.size)
+        self.file.write(self.fmt.pack(*values))
+        self.count += 1
+
+    def truncate(self, count):
+        self.file.truncate(count * self.fmt.size)
+        self.count = count
+
+    def overwrite_last(self, *values):
+        self.file.seek((self.count - 1) * self.fmt.size)
+        self.file.write(self.fmt.pack(*values))
+
+    def view(self):
+        # remap whenever the file grew since the last read; a scan still
+        # holding the previous map keeps it alive until it finishes
+        self.file.flush()
+        size = len(self) * self.fmt.size
+        if size != self.mapped:
+            self.map = None
+            if size > 0:
+                self.map = mmap.mmap(self.file.fileno(), size, access=mmap.ACCESS_READ)
+            self.mapped = size
+        return self.map
+
+    def get(self, row):
+        return self.fmt.unpack_from(self.view(), row * self.fmt.size)
+
+    def release(self):
+        # dropped rather than closed: a scan still holding the map keeps it
+        # (and its descriptor) alive until it finishes
+        self.map = None
+        self.mapped = 0
+
+    def close(self):
+        self.release()
+        self.file.close()
+
+
+class Keys:
+    # sequence view of the first field of a column so bisect can search the mmap
+    def __init__(self, column, lo, hi):
+        self.column = column
+        self.lo = lo
+        self.hi = hi
+
+    def __len__(self):
+        return self.hi - self.lo
+
+    def __getitem__(self, i):
+        return self.column.get(self.lo + i)[0]
+
+
+def valid_address(address):
+    return ADDRESS.fullmatch(address) is not None
+
+
+def mean_rollup(minute, low, high, total, count):
+    return minute * MINUTE_MS, low, high, total / count, count
+
+
+class Series:
+    def __init__(self, path):
+        os.makedirs(path, exist_ok=True)
+        self.ts = Column(os.path.join(path, "ts.col"), TS)
+        self.val = Column(os.path.join(path, "val.col"), VAL)
+        self.idx = Column(os.path.join(path, "window.idx"), IDX)
+        self.minute = Column(os.path.join(path, "minute.col"), ROLLUP)
+        # a crash between the two column writes leaves a dangling timestamp
+        rows = min(len(self.ts), len(self.val))
+        self.ts.truncate(rows)
+        self.val.truncate(rows)
+        self.rows = rows
+        self.last_ts = self.ts.get(rows - 1)[0] if rows else None
+        self.last_window = self.idx.get(len(self.idx) - 1)[0] if len(self.idx) else None
+        self.last_minute = self.minute.get(len(self.minute) - 1) if len(self.minute) else None
+
+    def append(self, ts, value):
+        if self.last_ts is not None and ts < self.last_ts:
+            raise ValueError("timestamp %d is older than last stored %d" % (ts, self.last_ts))
+        window = ts // INDEX_WINDOW_MS
+        if window != self.last_window:
+            self.idx.append(window, self.rows)
+            self.last_window = window
+        self.ts.append(ts)
+        self.val.append(value)
+        self.rows += 1
+        self.last_ts = ts
+        self.update_rollup(ts // MINUTE_MS, value)
+
+    def update_rollup(self, minute, value):
+        last = self.last_minute
+        if last is not None and last[0] == minute:
+            rollup = (minute, min(last[1], value), max(last[2], value), last[3] + value, last[4] + 1)
+            self.minute.overwrite_last(*rollup)
+        else:
+            rollup = (minute, value, value, value, 1)
+            self.minute.append(*rollup)
+        self.last_minute = rollup
+
+    def row_range(self, start, end):
+        # narrow the search with the window index, then bisect the timestamps
+        windows = Keys(self.idx, 0, len(self.idx))
+        lo, hi = 0, self.rows
+        i = bisect.bisect_right(windows, start // INDEX_WINDOW_MS) - 1
+        if i >= 0:
+            lo = self.idx.get(i)[1]
+        j = bisect.bisect_right(windows, end // INDEX_WINDOW_MS)
+        if j < len(windows):
+            hi = self.idx.get(j)[1]
+        ts = Keys(self.ts, lo, hi)
+        return lo + bisect.bisect_left(ts, start), lo + bisect.bisect_left(ts, end)
+
+    def scan(self, start, end):
+        # rows and maps are resolved before returning, so the scan outlives
+        # the store closing the series
+        first, last = self.row_range(start, end)
+        ts = self.ts.view()
+        val = self.val.view()
+        return ((TS.unpack_from(ts, row * TS.size)[0], VAL.unpack_from(val, row * VAL.size)[0])
+                for row in range(first, last))
+
+    def rollups(self, start, end):
+        minutes = Keys(self.minute, 0, len(self.minute))
+        first = bisect.bisect_left(minutes, start // MINUTE_MS)
+        last = bisect.bisect_left(minutes, -(-end // MINUTE_MS))
+        view = self.minute.view()
+        return (mean_rollup(*ROLLUP.unpack_from(view, row * ROLLUP.size)) for row in range(first, last))
+
+    def flush(self):
+        for column in (self.ts, self.val, self.idx, self.minute):
+            column.file.flush()
+
+    def close(self):
+        for column in (self.ts, self.val, self.idx, self.minute):
+            column.close()
+
+
+class Store:
+    def __init__(self, root, max_open=MAX_OPEN_SERIES):
+        self.root = root
+        self.max_open = max_open
+        self.series = collections.OrderedDict()  # least recently used first
+        os.makedirs(root, exist_ok=True)
+
+    def sensors(self):
+        return sorted(os.listdir(self.root))
+
+    def get(self, address, create=True):
+        # the series of a sensor, None if it is not on disk and create is False
+        if address in self.series:
+            self.series.move_to_end(address)
+            return self.series[address]
+        if not valid_address(address):
+            raise ValueError("invalid sensor address %r" % address)
+        path = os.path.join(self.root, address)
+        if not create and not os.path.isdir(path):
+            return None
+        if len(self.series) >= self.max_open:
+            self.series.popitem(last=False)[1].close()
+        self.series[address] = Series(path)
+        return self.series[address]
+
+    def append(self, address, ts, value):
+        self.get(address).append(ts, value)
+
+    def scan(self, address, start, end):
+        # (timestamp, value) pairs with start <= timestamp < end
+        series = self.get(address, create=False)
+        return series.scan(start, end) if series is not None else iter(())
+
+    def rollups(self, address, start, end):
+        # (minute start, min, max, mean, count) for the minutes overlapping [start, end)
+        series = self.get(address, create=False)
+        return series.rollups(start, end) if series is not None else iter(())
+
+    def flush(self):
+        for series in self.series.values():
+            series.flush()
+
+    def close(self):
+        for series in self.series.values():
+            series.close()
+        self.series.clear()
@@ -0,0 +1,113 @@
+import os
+import shutil
+import tempfile
+import unittest
+
+from store import INDEX_WINDOW_MS, MINUTE_MS, Store
+
+# python3 -m unittest test_store
+
+
+class StoreTest(unittest.TestCase):
+    def setUp(self):
+        self.root = tempfile.mkdtemp()
+        self.store = Store(self.root)
+
+    def tearDown(self):
+        self.store.close()
+        shutil.rmtree(self.root)
+
+    def fill(self, address, rows):
+        for ts, value in rows:
+            self.store.append(address, ts, value)
+        self.store.flush()
+
+    def test_scan_range(self):
+        # rows spread over several index windows, scans bisect across them
+        rows = [(i * INDEX_WINDOW_MS // 4, i) for i in range(20)]
+        self.fill("2.0", rows)
+        for start, end in [(0, 1), (0, 5 * INDEX_WINDOW_MS), (INDEX_WINDOW_MS + 1, 3 * INDEX_WINDOW_MS),
+                           (-1, 0), (10 * INDEX_WINDOW_MS, 11 * INDEX_WINDOW_MS)]:
+            expected = [row for row in rows if start <= row[0] < end]
+            self.assertEqual(list(self.store.scan("2.0", start, end)), expected)
+
+    def test_rollups(self):
+        self.fill("2.0", [(0, 5), (1000, -3), (MINUTE_MS - 1, 10), (MINUTE_MS, 7), (3 * MINUTE_MS, 1)])
+        self.assertEqual(list(self.store.rollups("2.0", 0, 2 * MINUTE_MS)),
+                         [(0, -3, 10, 4.0, 3), (MINUTE_MS, 7, 7, 7.0, 1)])
+        self.assertEqual(list(self.store.rollups("2.0", MINUTE_MS + 1, 3 * MINUTE_MS + 1)),
+                         [(MINUTE_MS, 7, 7, 7.0, 1), (3 * MINUTE_MS, 1, 1, 1.0, 1)])
+
+    def test_out_of_order(self):
+        self.fill("2.0", [(100, 1)])
+        with self.assertRaises(ValueError):
+            self.store.append("2.0", 99, 2)
+
+    def test_reopen(self):
+        self.fill("2.0", [(0, 1), (MINUTE_MS + 5, 2)])
+        self.store.close()
+        self.store = Store(self.root)
+        # appends after a reopen extend the last rollup and the columns
+        self.fill("2.0", [(MINUTE_MS + 6, 4), (INDEX_WINDOW_MS, 3)])
+        self.assertEqual(list(self.store.scan("2.0", 0, 2 * INDEX_WINDOW_MS)),
+                         [(0, 1), (MINUTE_MS + 5, 2), (MINUTE_MS + 6, 4), (INDEX_WINDOW_MS, 3)])
+        self.assertEqual(list(self.store.rollups("2.0", MINUTE_MS, 2 * MINUTE_MS)), [(MINUTE_MS, 2, 4, 3.0, 2)])
+
+    def test_recover_dangling_timestamp(self):
+        # a crash between the timestamp and the value write
+        self.fill("2.0", [(0, 1), (10, 2)])
+        self.store.close()
+        with open(os.path.join(self.root, "2.0", "ts.col"), "ab") as f:
+            f.write((20).to_bytes(8, "little"))
+        self.store = Store(self.root)
+        self.assertEqual(list(self.store.scan("2.0", 0, 100)), [(0, 1), (10, 2)])
+        self.fill("2.0", [(30, 3)])
+        self.assertEqual(list(self.store.scan("2.0", 0, 100)), [(0, 1), (10, 2), (30, 3)])
+
+    def test_unknown_sensor(self):
+        self.fill("2.0", [(0, 1)])
+        self.assertEqual(list(self.store.scan("9.9", 0, 100)), [])
+        self.assertEqual(list(self.store.rollups("9.9", 0, 100)), [])
+        self.assertEqual(self.store.sensors(), ["2.0"])
+
+    def test_invalid_address(self):
+        # addresses are directory names, nothing outside the root can be reached
+        for address in ["..", "../2.0", "2.0/..", "/tmp", "2", "2.0\n", ""]:
+            with self.assertRaises(ValueError):
+                self.store.append(address, 0, 1)
+            with self.assertRaises(ValueError):
+                self.store.scan(address, 0, 100)
+        self.assertEqual(os.listdir(self.root), [])
+
+    def test_open_series_bounded(self):
+        # more sensors than open series, the least recently used are closed and reopened on demand
+        self.store.close()
+        self.store = Store(self.root, max_open=4)
+        for i in range(10):
+            self.fill("%d.0" % i, [(0, i), (MINUTE_MS, i + 1)])
+        self.assertLessEqual(len(self.store.series), 4)
+        scan = self.store.scan("0.0", 0, 2 * MINUTE_MS)
+        rollups = self.store.rollups("1.0", 0, 2 * MINUTE_MS)
+        for i in range(10):
+            self.assertEqual(list(self.store.scan("%d.0" % i, 0, 100)), [(0, i)])
+            self.assertLessEqual(len(self.store.series), 4)
+        # scans started before their series was closed still finish
+        self.assertEqual(list(scan), [(0, 0), (MINUTE_MS, 1)])
+        self.assertEqual(list(rollups), [(0, 1, 1, 1.0, 1), (MINUTE_MS, 2, 2, 2.0, 1)])
+        self.fill("0.0", [(2 * MINUTE_MS, 5)])
+        self.assertEqual(list(self.store.scan("0.0", 0, 3 * MINUTE_MS)), [(0, 0), (MINUTE_MS, 1), (2 * MINUTE_MS, 5)])
+
+    def test_open_descriptors_bounded(self):
+        if not os.path.isdir("/proc/self/fd"):
+            self.skipTest("no /proc/self/fd")
+        self.store.close()
+        self.store = Store(self.root, max_open=8)
+        before = len(os.listdir("/proc/self/fd"))
+        for i in range(100):
+            self.fill("%d.0" % i, [(0, i)])
+            self.assertEqual(list(self.store.scan("%d.0" % i, 0, 1)), [(0, i)])
+        self.assertLessEqual(len(os.listdir("/proc/self/fd")) - before, 8 * 8)
+
+
+if __name__ == "__main__":
+    unittest.main()